@@ -0,0 +1,81 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "eval.h"
+#include "gc.h"
+#include "util.h"
+
+using namespace lisp;
+
+// keeps a large heap alive while allocating a lot of short lived objects,
+// then reports how long the mutator was stopped by the collector
+static const char * program = R"(
+(defun range (a b)
+  (if (= a b)
+    nil
+    (cons a (range (+ a 1) b))))
+
+(defvar live (map (lambda (n) (range 0 100)) (range 0 1000)))
+
+(defun churn (n)
+  (if (= n 0)
+    0
+    (churn (- n (car (list 1 2 3 4 5 6 7 8))))))
+
+(churn 2000000)
+)";
+
+static int run( gc::Mode mode, const char * name, std::size_t threshold )
+{
+  gc::set_mode( mode );
+  gc::set_threshold( threshold );
+  gc::stats.max_pause_ns   = 0;
+  gc::stats.total_pause_ns = 0;
+
+  std::size_t collections = gc::stats.collections;
+  std::size_t minor       = gc::stats.minor_collections;
+  std::size_t steps       = gc::stats.steps;
+
+  std::ostringstream out, err;
+  IO io( out, err );
+
+  int r;
+  {
+    Context ctx;
+    r = eval( program, ctx, io, FLAG_NONE );
+  }
+
+  if( r != 0 )
+  {
+    std::cerr << err.str() << std::endl;
+    return r;
+  }
+
+  std::cout << name << std::endl;
+  std::cout << "  full collections:  " << gc::stats.collections - collections << std::endl;
+  std::cout << "  minor collections: " << gc::stats.minor_collections - minor << std::endl;
+  std::cout << "  incremental steps: " << gc::stats.steps - steps << std::endl;
+  std::cout << "  max pause:         " << gc::stats.max_pause_ns / 1000 << " us" << std::endl;
+  std::cout << "  total pause:       " << gc::stats.total_pause_ns / 1000 << " us" << std::endl;
+  return 0;
+}
+
+int main( int argc, char ** argv )
+{
+  std::size_t budget = argc > 1 ? std::stoul( argv[1] ) : 0;
+  if( budget > 0 )
+  {
+    gc::set_step_budget( budget );
+  }
+
+  // both runs start from the same collection threshold
+  std::size_t threshold = gc::stats.threshold;
+
+  int r = run( gc::STOP_THE_WORLD, "stop-the-world", threshold );
+  if( r == 0 )
+  {
+    r = run( gc::INCREMENTAL, "incremental", threshold );
+  }
+  return r;
+}
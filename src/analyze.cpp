@@ -0,0 +1,396 @@
+#include "analyze.h"
+#include "eval.h"
+
+#include <algorithm>
+
+namespace lisp
+{
+
+///////////////////////////////////////////////////////////////////////////////
+
+Node::Node( Kind k, Expr * e )
+    : gc::Garbage()
+    , kind( k )
+    , depth( 0 )
+    , slot( 0 )
+    , expr( e )
+    , macro( nullptr )
+    , expansion( nullptr )
+{
+}
+
+void Node::mark()
+{
+  gc::mark( expr );
+  gc::mark( macro );
+  gc::mark( expansion );
+  for( Node * node : nodes )
+  {
+    gc::mark( node );
+  }
+}
+
+void Node::append( Node * node )
+{
+  nodes.push_back( node );
+  gc::write_barrier( this, node );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static void add_name( Scope & scope, Expr * symbol )
+{
+  if( std::find( scope.names.begin(), scope.names.end(), symbol ) == scope.names.end() )
+  {
+    scope.names.push_back( symbol );
+  }
+}
+
+Scope Scope::of_params( Expr * params, const Scope * parent )
+{
+  Scope scope{ parent, {} };
+  for( ; params->is_cons(); params = params->cdr() )
+  {
+    if( !is_rest_param( params->car() ) )
+    {
+      add_name( scope, params->car() );
+    }
+  }
+  return scope;
+}
+
+Scope Scope::of_bindings( Expr * bindings, const Scope * parent )
+{
+  Scope scope{ parent, {} };
+  for( ; bindings->is_cons(); bindings = bindings->cdr() )
+  {
+    add_name( scope, bindings->car()->car() );
+  }
+  return scope;
+}
+
+const Scope * Scope::root()
+{
+  static const Scope scope{ nullptr, {} };
+  return &scope;
+}
+
+static bool is_global( const Scope * scope )
+{
+  for( ; scope != nullptr; scope = scope->parent )
+  {
+    if( scope == Scope::root() )
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool resolve( const Scope * scope, Expr * symbol, std::uint32_t & depth, std::uint32_t & slot )
+{
+  for( depth = 0; scope != nullptr; scope = scope->parent, depth++ )
+  {
+    auto it = std::find( scope->names.begin(), scope->names.end(), symbol );
+    if( it != scope->names.end() )
+    {
+      slot = static_cast<std::uint32_t>( it - scope->names.begin() );
+      return true;
+    }
+  }
+  return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static Node * make_node( Node::Kind kind, Expr * expr )
+{
+  return gc::alloc<Node>( kind, expr );
+}
+
+static std::size_t length( Expr * list )
+{
+  std::size_t n = 0;
+  for( ; list->is_cons(); list = list->cdr() )
+  {
+    n++;
+  }
+  return n;
+}
+
+// a list of a symbol and its value, as in a let or the head of a loop
+static bool is_binding( Expr * binding )
+{
+  return length( binding ) >= 2 && binding->car()->is_symbol();
+}
+
+static bool is_bindings( Expr * bindings )
+{
+  for( ; bindings->is_cons(); bindings = bindings->cdr() )
+  {
+    if( !is_binding( bindings->car() ) )
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool is_clauses( Expr * clauses )
+{
+  for( ; clauses->is_cons(); clauses = clauses->cdr() )
+  {
+    if( !clauses->car()->is_cons() )
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// a node with one child per element of 'list'
+static Node * analyze_all( Node::Kind kind, Expr * expr, Expr * list, const Scope * scope )
+{
+  Node * node = make_node( kind, expr );
+  for( ; list->is_cons(); list = list->cdr() )
+  {
+    node->append( analyze( list->car(), scope ) );
+  }
+  return node;
+}
+
+// forms that are evaluated in order, as the body of a cond clause or a loop
+static Node * analyze_sequence( Expr * body, const Scope * scope )
+{
+  if( !body->is_cons() )
+  {
+    return make_node( Node::NODE_CONST, make_nil() );
+  }
+  if( !body->cdr()->is_cons() )
+  {
+    return analyze( body->car(), scope );
+  }
+  return analyze_all( Node::NODE_PROGN, nullptr, body, scope );
+}
+
+// builds the same list as evaluating the expand()ed template, but only
+// allocates the cells of the result
+static Node * analyze_template( Expr * tmpl, const Scope * scope )
+{
+  if( !tmpl->is_cons() )
+  {
+    return make_node( Node::NODE_CONST, tmpl );
+  }
+
+  Expr * car  = tmpl->car();
+  Node * node = nullptr;
+  if( car->is_cons() && car->car()->is_symbol( SYM_UNQUOTE ) )
+  {
+    node = make_node( Node::NODE_CONS, nullptr );
+    node->append( analyze( car->cdr()->car(), scope ) );
+  }
+  else if( car->is_cons() && car->car()->is_symbol( SYM_UNQUOTE_SPLICE ) )
+  {
+    node = make_node( Node::NODE_SPLICE, nullptr );
+    node->append( analyze( car->cdr()->car(), scope ) );
+  }
+  else
+  {
+    node = make_node( Node::NODE_CONS, nullptr );
+    node->append( analyze_template( car, scope ) );
+  }
+  node->append( analyze_template( tmpl->cdr(), scope ) );
+  return node;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// malformed special forms are left to the tree walker, so that they fail
+// the same way in both engines
+Node * analyze( Expr * expr, const Scope * scope )
+{
+  if( expr->is_void() )
+  {
+    return make_node( Node::NODE_CONST, make_void() );
+  }
+
+  if( expr->is_symbol() )
+  {
+    std::uint32_t depth, slot;
+    if( resolve( scope, expr, depth, slot ) )
+    {
+      Node * node = make_node( Node::NODE_LOCAL, expr );
+      node->depth = depth;
+      node->slot  = slot;
+      return node;
+    }
+    return make_node( is_global( scope ) && !is_frame_bound( expr ) ? Node::NODE_GLOBAL : Node::NODE_REF, expr );
+  }
+
+  if( !expr->is_cons() )
+  {
+    return make_node( Node::NODE_CONST, expr );
+  }
+
+  Expr * op        = expr->car();
+  Expr * args      = expr->cdr();
+  std::size_t argc = length( args );
+  Node * node      = nullptr;
+
+  switch( op->id )
+  {
+    case SYM_QUOTE :
+      {
+        if( argc >= 1 )
+        {
+          node = make_node( Node::NODE_CONST, args->car() );
+        }
+        break;
+      }
+    case SYM_DEFINE :
+      {
+        if( argc >= 2 && args->car()->is_symbol() )
+        {
+          node = make_node( Node::NODE_DEFINE, args->car() );
+          node->append( analyze( args->cdr()->car(), scope ) );
+        }
+        break;
+      }
+    case SYM_LAMBDA :
+      {
+        if( argc >= 1 )
+        {
+          node = make_node( Node::NODE_LAMBDA, args );
+          if( argc >= 2 )
+          {
+            Scope inner = Scope::of_params( args->car(), scope );
+            node->append( analyze( args->cdr()->car(), &inner ) );
+          }
+        }
+        break;
+      }
+    case SYM_MACRO :
+      {
+        if( argc >= 1 )
+        {
+          node = make_node( Node::NODE_MACRO, args );
+        }
+        break;
+      }
+    case SYM_IF :
+      {
+        if( argc >= 3 )
+        {
+          node = analyze_all( Node::NODE_IF, nullptr, args, scope );
+        }
+        break;
+      }
+    case SYM_PROGN :
+      {
+        if( argc >= 1 )
+        {
+          node = analyze_all( Node::NODE_PROGN, nullptr, args, scope );
+        }
+        break;
+      }
+    case SYM_OR :
+      {
+        node = analyze_all( Node::NODE_OR, nullptr, args, scope );
+        break;
+      }
+    case SYM_AND :
+      {
+        node = analyze_all( Node::NODE_AND, nullptr, args, scope );
+        break;
+      }
+    case SYM_LET :
+      {
+        if( argc >= 2 && is_bindings( args->car() ) )
+        {
+          Scope inner = Scope::of_bindings( args->car(), scope );
+          node        = make_node( Node::NODE_LET, args->car() );
+          for( Expr * it = args->car(); it->is_cons(); it = it->cdr() )
+          {
+            node->append( analyze( it->car()->cdr()->car(), &inner ) );
+          }
+          node->append( analyze( args->cdr()->car(), &inner ) );
+        }
+        break;
+      }
+    case SYM_COND :
+      {
+        if( is_clauses( args ) )
+        {
+          node = make_node( Node::NODE_COND, nullptr );
+          for( Expr * it = args; it->is_cons(); it = it->cdr() )
+          {
+            node->append( analyze( it->car()->car(), scope ) );
+            node->append( analyze_sequence( it->car()->cdr(), scope ) );
+          }
+        }
+        break;
+      }
+    case SYM_WHILE :
+      {
+        if( argc >= 1 )
+        {
+          node = make_node( Node::NODE_WHILE, nullptr );
+          node->append( analyze( args->car(), scope ) );
+          node->append( analyze_sequence( args->cdr(), scope ) );
+        }
+        break;
+      }
+    case SYM_DOTIMES :
+    case SYM_DOLIST :
+      {
+        if( argc >= 1 && is_binding( args->car() ) )
+        {
+          // the variable lives in a frame of its own, the count or list is
+          // evaluated in it like the value of a let binding
+          Scope inner = Scope{ scope, { args->car()->car() } };
+          node        = make_node( op->id == SYM_DOTIMES ? Node::NODE_DOTIMES : Node::NODE_DOLIST, args->car() );
+          node->append( analyze( args->car()->cdr()->car(), &inner ) );
+          node->append( analyze_sequence( args->cdr(), &inner ) );
+        }
+        break;
+      }
+    case SYM_QUASIQUOTE :
+      {
+        if( argc >= 1 )
+        {
+          node = analyze_template( args->car(), scope );
+        }
+        break;
+      }
+    case SYM_UNQUOTE :
+#ifdef __linux__
+    case SYM_TO_STREAM :
+    case SYM_FROM_STREAM :
+    case SYM_PIPE :
+#endif
+      break;
+    default :
+      {
+        node = analyze_all( Node::NODE_CALL, expr, expr, scope );
+        break;
+      }
+  }
+
+  if( node == nullptr )
+  {
+    node = make_node( Node::NODE_FALLBACK, expr );
+  }
+  return node;
+}
+
+Node * analyze_body( Expr * params, Expr * body, const Scope * scope )
+{
+  Scope inner = Scope::of_params( params, scope );
+  return analyze( body, &inner );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+} // namespace lisp
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "eval.h"
+#include "expr.h"
+#include "gc.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace lisp
+{
+
+///////////////////////////////////////////////////////////////////////////////
+
+// a form that was analyzed ahead of evaluation. the special form of every
+// expression is decided once, so executing a node never matches keywords.
+class Node : public gc::Garbage
+{
+public:
+  enum Kind : std::uint8_t
+  {
+    NODE_CONST,    // expr is the value
+    NODE_REF,      // expr is the symbol to look up by name
+    NODE_LOCAL,    // expr is the symbol found in slot 'slot' of the frame 'depth' levels up
+    NODE_GLOBAL,   // expr is the symbol of a global, cache remembers its root slot
+    NODE_DEFINE,   // expr is the symbol, nodes[0] the value
+    NODE_LAMBDA,   // expr is (params . body), nodes[0] the analyzed body
+    NODE_MACRO,    // expr is (params . body)
+    NODE_IF,       // nodes are the condition, then and else branch
+    NODE_PROGN,    // nodes are evaluated in order
+    NODE_LET,      // expr are the bindings, nodes their values and the body
+    NODE_COND,     // nodes are pairs of condition and body
+    NODE_OR,       // nodes are the operands
+    NODE_AND,      // nodes are the operands
+    NODE_WHILE,    // nodes are the condition and the body
+    NODE_DOTIMES,  // expr is the (var count) head, nodes the count and the body
+    NODE_DOLIST,   // expr is the (var list) head, nodes the list and the body
+    NODE_CALL,     // expr is the form, nodes the operator and the arguments
+    NODE_CONS,     // nodes are the car and the cdr of a new cell of a quasiquote template
+    NODE_SPLICE,   // nodes are an unquote-splice list and the rest of the template
+    NODE_FALLBACK, // expr is evaluated by the tree walker
+  };
+
+  Node( Kind kind, Expr * expr );
+  void mark();
+  void append( Node * node );
+
+  Kind kind;
+  std::uint32_t depth;
+  std::uint32_t slot;
+  Expr * expr;
+  std::vector<Node *> nodes;
+  GlobalCache cache;
+  Expr * macro;     // the macro the operator of a call was last expanded with
+  Node * expansion; // and the analyzed expansion of the call
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+// the names declared by the frames around the analyzed code, in the same
+// order as Context::declare numbers their slots
+struct Scope
+{
+  const Scope * parent;
+  std::vector<Expr *> names;
+
+  static Scope of_params( Expr * params, const Scope * parent );
+  static Scope of_bindings( Expr * bindings, const Scope * parent );
+
+  // the scope of the root context, it declares no names
+  static const Scope * root();
+};
+
+// variables bound by one of the surrounding scopes are resolved to their
+// slots. if the outermost scope is the root all other variables are globals,
+// otherwise or if a frame ever bound them they are looked up by name.
+Node * analyze( Expr * expr, const Scope * scope = nullptr );
+
+// the body of a lambda or macro, analyzed in the scope of its parameters
+// inside of 'scope'
+Node * analyze_body( Expr * params, Expr * body, const Scope * scope = nullptr );
+
+///////////////////////////////////////////////////////////////////////////////
+
+} // namespace lisp
@@ -91,6 +91,15 @@ public:
         std::string key = arg.substr( 2 );
         // std::cout << "KEY: " << key << std::endl;
 
+        // options may also be given as '--key=value'
+        std::size_t eq = key.find( '=' );
+        std::string inline_value;
+        if( eq != std::string::npos )
+        {
+          inline_value = key.substr( eq + 1 );
+          key          = key.substr( 0, eq );
+        }
+
         auto it = m_options.find( key );
         if( it != m_options.end() )
         {
@@ -99,6 +108,11 @@ public:
             // std::cout << "is present" << std::endl;
             it->second.is_present = true;
           }
+          else if( eq != std::string::npos )
+          {
+            it->second.value_str  = inline_value;
+            it->second.is_present = true;
+          }
           else
           {
             std::string value = argv[i + 1];
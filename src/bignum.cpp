@@ -0,0 +1,437 @@
+#include "bignum.h"
+
+#include <algorithm>
+#include <bit>
+#include <utility>
+
+namespace lisp
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// magnitudes
+
+using Digits = Bignum::Digits;
+
+// operands with fewer digits are multiplied the schoolbook way
+constexpr std::size_t KARATSUBA_THRESHOLD = 32;
+
+static void trim( Digits & digits )
+{
+  while( !digits.empty() && digits.back() == 0 )
+  {
+    digits.pop_back();
+  }
+}
+
+static int compare_digits( const Digits & a, const Digits & b )
+{
+  if( a.size() != b.size() )
+  {
+    return ( a.size() < b.size() ) ? -1 : 1;
+  }
+
+  for( std::size_t i = a.size(); i-- > 0; )
+  {
+    if( a[i] != b[i] )
+    {
+      return ( a[i] < b[i] ) ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+static Digits add_digits( const Digits & a, const Digits & b )
+{
+  const Digits & longer  = ( a.size() >= b.size() ) ? a : b;
+  const Digits & shorter = ( a.size() >= b.size() ) ? b : a;
+
+  Digits sum( longer.size() + 1 );
+  std::uint64_t carry = 0;
+  for( std::size_t i = 0; i < longer.size(); i++ )
+  {
+    carry += std::uint64_t( longer[i] ) + ( ( i < shorter.size() ) ? shorter[i] : 0 );
+    sum[i] = static_cast<std::uint32_t>( carry );
+    carry >>= 32;
+  }
+  sum[longer.size()] = static_cast<std::uint32_t>( carry );
+  trim( sum );
+  return sum;
+}
+
+// 'a' - 'b', where 'a' is not less than 'b'
+static Digits sub_digits( const Digits & a, const Digits & b )
+{
+  Digits difference( a.size() );
+  std::uint64_t borrow = 0;
+  for( std::size_t i = 0; i < a.size(); i++ )
+  {
+    std::uint64_t digit = std::uint64_t( a[i] ) - ( ( i < b.size() ) ? b[i] : 0 ) - borrow;
+    difference[i]       = static_cast<std::uint32_t>( digit );
+    borrow              = digit >> 63;
+  }
+  trim( difference );
+  return difference;
+}
+
+// adds 'x' times 2^(32 * offset) to 'sum', which has room for the result
+static void add_shifted( Digits & sum, const Digits & x, std::size_t offset )
+{
+  std::uint64_t carry = 0;
+  for( std::size_t i = 0; i < x.size(); i++ )
+  {
+    carry += std::uint64_t( sum[offset + i] ) + x[i];
+    sum[offset + i] = static_cast<std::uint32_t>( carry );
+    carry >>= 32;
+  }
+  for( std::size_t i = offset + x.size(); carry != 0; i++ )
+  {
+    carry += sum[i];
+    sum[i] = static_cast<std::uint32_t>( carry );
+    carry >>= 32;
+  }
+}
+
+static Digits multiply_schoolbook( const Digits & a, const Digits & b )
+{
+  if( a.empty() || b.empty() )
+  {
+    return Digits();
+  }
+
+  Digits product( a.size() + b.size() );
+  for( std::size_t i = 0; i < a.size(); i++ )
+  {
+    std::uint64_t carry = 0;
+    for( std::size_t j = 0; j < b.size(); j++ )
+    {
+      carry += std::uint64_t( a[i] ) * b[j] + product[i + j];
+      product[i + j] = static_cast<std::uint32_t>( carry );
+      carry >>= 32;
+    }
+    product[i + b.size()] = static_cast<std::uint32_t>( carry );
+  }
+  trim( product );
+  return product;
+}
+
+static Digits low_digits( const Digits & digits, std::size_t m )
+{
+  Digits low( digits.begin(), digits.begin() + std::min( m, digits.size() ) );
+  trim( low );
+  return low;
+}
+
+static Digits high_digits( const Digits & digits, std::size_t m )
+{
+  return ( digits.size() > m ) ? Digits( digits.begin() + m, digits.end() ) : Digits();
+}
+
+static Digits multiply( const Digits & a, const Digits & b )
+{
+  if( std::min( a.size(), b.size() ) < KARATSUBA_THRESHOLD )
+  {
+    return multiply_schoolbook( a, b );
+  }
+
+  // with a = a1 * B^m + a0 and b = b1 * B^m + b0 the product is
+  // z2 * B^2m + z1 * B^m + z0, where z1 = (a0 + a1) * (b0 + b1) - z2 - z0
+  std::size_t m = std::max( a.size(), b.size() ) / 2;
+  Digits a0     = low_digits( a, m );
+  Digits a1     = high_digits( a, m );
+  Digits b0     = low_digits( b, m );
+  Digits b1     = high_digits( b, m );
+
+  Digits z0 = multiply( a0, b0 );
+  Digits z2 = multiply( a1, b1 );
+  Digits z1 = multiply( add_digits( a0, a1 ), add_digits( b0, b1 ) );
+  z1        = sub_digits( sub_digits( z1, z0 ), z2 );
+
+  Digits product( a.size() + b.size() );
+  add_shifted( product, z0, 0 );
+  add_shifted( product, z1, m );
+  add_shifted( product, z2, 2 * m );
+  trim( product );
+  return product;
+}
+
+// 'digits' = 'digits' * 'factor' + 'addend'
+static void multiply_add( Digits & digits, std::uint32_t factor, std::uint32_t addend )
+{
+  std::uint64_t carry = addend;
+  for( std::uint32_t & digit : digits )
+  {
+    carry += std::uint64_t( digit ) * factor;
+    digit = static_cast<std::uint32_t>( carry );
+    carry >>= 32;
+  }
+  if( carry != 0 )
+  {
+    digits.push_back( static_cast<std::uint32_t>( carry ) );
+  }
+}
+
+// the value of the lowest two digits
+static std::uint64_t magnitude( const Digits & digits )
+{
+  std::uint64_t value = 0;
+  for( std::size_t i = std::min<std::size_t>( digits.size(), 2 ); i-- > 0; )
+  {
+    value = ( value << 32 ) | digits[i];
+  }
+  return value;
+}
+
+// 'digits' = 'digits' / 'divisor', returns the remainder
+static std::uint32_t divide( Digits & digits, std::uint32_t divisor )
+{
+  std::uint64_t remainder = 0;
+  for( std::size_t i = digits.size(); i-- > 0; )
+  {
+    std::uint64_t current = ( remainder << 32 ) | digits[i];
+    digits[i]             = static_cast<std::uint32_t>( current / divisor );
+    remainder             = current % divisor;
+  }
+  trim( digits );
+  return static_cast<std::uint32_t>( remainder );
+}
+
+// 'u' / 'v' rounded towards zero, where 'v' has at least two digits. this is
+// algorithm D of knuth, with both operands shifted so that the top digit of
+// 'v' has its high bit set
+static Digits divide_digits( const Digits & u, const Digits & v )
+{
+  if( compare_digits( u, v ) < 0 )
+  {
+    return Digits();
+  }
+
+  const std::uint64_t base = std::uint64_t( 1 ) << 32;
+  const std::size_t n      = v.size();
+  const std::size_t m      = u.size() - n;
+  const int shift          = std::countl_zero( v.back() );
+
+  Digits vn( n );
+  for( std::size_t i = n; i-- > 1; )
+  {
+    vn[i] = static_cast<std::uint32_t>( ( std::uint64_t( v[i] ) << shift ) | ( std::uint64_t( v[i - 1] ) >> ( 32 - shift ) ) );
+  }
+  vn[0] = v[0] << shift;
+
+  Digits un( u.size() + 1 );
+  un[u.size()] = static_cast<std::uint32_t>( std::uint64_t( u.back() ) >> ( 32 - shift ) );
+  for( std::size_t i = u.size(); i-- > 1; )
+  {
+    un[i] = static_cast<std::uint32_t>( ( std::uint64_t( u[i] ) << shift ) | ( std::uint64_t( u[i - 1] ) >> ( 32 - shift ) ) );
+  }
+  un[0] = u[0] << shift;
+
+  Digits quotient( m + 1 );
+  for( std::size_t j = m + 1; j-- > 0; )
+  {
+    // estimate the digit from the top two digits, it is at most two too large
+    std::uint64_t top  = ( std::uint64_t( un[j + n] ) << 32 ) | un[j + n - 1];
+    std::uint64_t qhat = top / vn[n - 1];
+    std::uint64_t rhat = top % vn[n - 1];
+    while( qhat >= base || qhat * vn[n - 2] > ( ( rhat << 32 ) | un[j + n - 2] ) )
+    {
+      qhat--;
+      rhat += vn[n - 1];
+      if( rhat >= base )
+      {
+        break;
+      }
+    }
+
+    // subtract qhat * vn from the current digits of un
+    std::int64_t borrow = 0;
+    std::int64_t t      = 0;
+    for( std::size_t i = 0; i < n; i++ )
+    {
+      std::uint64_t product = qhat * vn[i];
+      t                     = std::int64_t( un[i + j] ) - borrow - std::int64_t( product & 0xFFFFFFFF );
+      un[i + j]             = static_cast<std::uint32_t>( t );
+      borrow                = std::int64_t( product >> 32 ) - ( t >> 32 );
+    }
+    t         = std::int64_t( un[j + n] ) - borrow;
+    un[j + n] = static_cast<std::uint32_t>( t );
+
+    // the estimate was one too large, add vn back
+    quotient[j] = static_cast<std::uint32_t>( qhat );
+    if( t < 0 )
+    {
+      quotient[j]--;
+      std::uint64_t carry = 0;
+      for( std::size_t i = 0; i < n; i++ )
+      {
+        carry += std::uint64_t( un[i + j] ) + vn[i];
+        un[i + j] = static_cast<std::uint32_t>( carry );
+        carry >>= 32;
+      }
+      un[j + n] = static_cast<std::uint32_t>( un[j + n] + carry );
+    }
+  }
+
+  trim( quotient );
+  return quotient;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+Bignum::Bignum( std::int64_t value )
+    : m_negative( value < 0 )
+{
+  std::uint64_t rest = m_negative ? 0 - static_cast<std::uint64_t>( value ) : value;
+  while( rest != 0 )
+  {
+    m_digits.push_back( static_cast<std::uint32_t>( rest ) );
+    rest >>= 32;
+  }
+}
+
+Bignum::Bignum( bool negative, Digits digits )
+    : m_negative( negative && !digits.empty() )
+    , m_digits( std::move( digits ) )
+{
+}
+
+// the decimal digits are taken nine at a time
+constexpr std::uint32_t DECIMAL_CHUNK = 1000000000;
+
+bool Bignum::parse( std::string_view text, Bignum & result )
+{
+  bool negative = !text.empty() && text[0] == '-';
+  std::size_t i = negative ? 1 : 0;
+  if( i == text.size() )
+  {
+    return false;
+  }
+
+  Digits digits;
+  while( i < text.size() )
+  {
+    std::uint32_t chunk = 0;
+    std::uint32_t scale = 1;
+    for( int k = 0; k < 9 && i < text.size(); k++, i++ )
+    {
+      if( text[i] < '0' || '9' < text[i] )
+      {
+        return false;
+      }
+      chunk = chunk * 10 + ( text[i] - '0' );
+      scale = scale * 10;
+    }
+    multiply_add( digits, scale, chunk );
+  }
+
+  result = Bignum( negative, std::move( digits ) );
+  return true;
+}
+
+std::string Bignum::to_string() const
+{
+  if( is_zero() )
+  {
+    return "0";
+  }
+
+  Digits digits = m_digits;
+  std::vector<std::uint32_t> chunks;
+  while( !digits.empty() )
+  {
+    chunks.push_back( divide( digits, DECIMAL_CHUNK ) );
+  }
+
+  std::string text = m_negative ? "-" : "";
+  text += std::to_string( chunks.back() );
+  for( std::size_t i = chunks.size() - 1; i-- > 0; )
+  {
+    std::string chunk = std::to_string( chunks[i] );
+    text.append( 9 - chunk.size(), '0' );
+    text += chunk;
+  }
+  return text;
+}
+
+double Bignum::to_double() const
+{
+  double value = 0.0;
+  for( std::size_t i = m_digits.size(); i-- > 0; )
+  {
+    value = value * 4294967296.0 + m_digits[i];
+  }
+  return m_negative ? -value : value;
+}
+
+bool Bignum::is_small() const
+{
+  if( m_digits.size() > 2 )
+  {
+    return false;
+  }
+
+  // the magnitude of the smallest std::int64_t is one larger than the one of
+  // the largest
+  std::uint64_t limit = ( std::uint64_t( 1 ) << 63 ) - ( m_negative ? 0 : 1 );
+  return magnitude( m_digits ) <= limit;
+}
+
+std::int64_t Bignum::to_small() const
+{
+  std::uint64_t value = magnitude( m_digits );
+  return static_cast<std::int64_t>( m_negative ? 0 - value : value );
+}
+
+int Bignum::compare( const Bignum & a, const Bignum & b )
+{
+  if( a.m_negative != b.m_negative )
+  {
+    return a.m_negative ? -1 : 1;
+  }
+
+  int order = compare_digits( a.m_digits, b.m_digits );
+  return a.m_negative ? -order : order;
+}
+
+Bignum operator+( const Bignum & a, const Bignum & b )
+{
+  if( a.m_negative == b.m_negative )
+  {
+    return Bignum( a.m_negative, add_digits( a.m_digits, b.m_digits ) );
+  }
+
+  // the sign is the one of the larger magnitude
+  if( compare_digits( a.m_digits, b.m_digits ) >= 0 )
+  {
+    return Bignum( a.m_negative, sub_digits( a.m_digits, b.m_digits ) );
+  }
+  return Bignum( b.m_negative, sub_digits( b.m_digits, a.m_digits ) );
+}
+
+Bignum operator-( const Bignum & a, const Bignum & b )
+{
+  return a + Bignum( !b.m_negative, b.m_digits );
+}
+
+Bignum operator*( const Bignum & a, const Bignum & b )
+{
+  return Bignum( a.m_negative != b.m_negative, multiply( a.m_digits, b.m_digits ) );
+}
+
+Bignum operator/( const Bignum & a, const Bignum & b )
+{
+  Digits quotient;
+  if( b.m_digits.size() == 1 )
+  {
+    quotient = a.m_digits;
+    divide( quotient, b.m_digits[0] );
+  }
+  else
+  {
+    quotient = divide_digits( a.m_digits, b.m_digits );
+  }
+  return Bignum( a.m_negative != b.m_negative, std::move( quotient ) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+} // namespace lisp
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace lisp
+{
+
+///////////////////////////////////////////////////////////////////////////////
+
+// an integer of any size, stored as a sign and the 32 bit digits of its
+// magnitude, least significant first and without leading zeros. zero has
+// no digits and is never negative.
+class Bignum
+{
+public:
+  using Digits = std::vector<std::uint32_t>;
+
+  Bignum() = default;
+  explicit Bignum( std::int64_t value );
+
+  // 'text' is a decimal integer with an optional leading '-', false if it
+  // is not one
+  static bool parse( std::string_view text, Bignum & result );
+
+  std::string to_string() const;
+  double to_double() const;
+
+  // true if the value fits into an std::int64_t
+  bool is_small() const;
+  std::int64_t to_small() const;
+
+  bool is_zero() const
+  {
+    return m_digits.empty();
+  }
+
+  bool is_negative() const
+  {
+    return m_negative;
+  }
+
+  // -1, 0 or 1 if 'a' is less than, equal to or greater than 'b'
+  static int compare( const Bignum & a, const Bignum & b );
+
+  friend Bignum operator+( const Bignum & a, const Bignum & b );
+  friend Bignum operator-( const Bignum & a, const Bignum & b );
+  friend Bignum operator*( const Bignum & a, const Bignum & b );
+
+  // rounds towards zero like the division of integers, 'b' is not zero
+  friend Bignum operator/( const Bignum & a, const Bignum & b );
+
+private:
+  Bignum( bool negative, Digits digits );
+
+  bool m_negative = false;
+  Digits m_digits;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+} // namespace lisp
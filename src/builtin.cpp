@@ -1,12 +1,15 @@
 #include <cctype>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
+#include <functional>
 #include <sstream>
 #include <string>
 
 #include "builtin.h"
 #include "eval.h"
 #include "expr.h"
+#include "native.h"
 #include "parser.h"
 #include "tokenizer.h"
 
@@ -25,44 +28,15 @@ int list_length( Expr * lst )
 
 ///////////////////////////////////////////////////////////////////////////////
 
-#define ASSERT_ARG_COUNT( arg_list, n )                                        \
-  do                                                                           \
-  {                                                                            \
-    int len = list_length( arg_list );                                         \
-    if( len != n )                                                             \
-    {                                                                          \
-      std::ostringstream os;                                                   \
-      os << __FUNCTION__ << " expected " << n << " args but received " << len; \
-      return make_error( os.str().c_str() );                                   \
-    }                                                                          \
-  } while( 0 )
-
-///////////////////////////////////////////////////////////////////////////////
-
-#define ASSERT_MIN_ARG_COUNT( arg_list, n )                                             \
-  do                                                                                    \
-  {                                                                                     \
-    int len = list_length( arg_list );                                                  \
-    if( len < n )                                                                       \
-    {                                                                                   \
-      std::ostringstream os;                                                            \
-      os << __FUNCTION__ << " expected at least " << n << " args but received " << len; \
-      return make_error( os.str().c_str() );                                            \
-    }                                                                                   \
-  } while( 0 )
-
-///////////////////////////////////////////////////////////////////////////////
-
-#define ASSERT_ARG_TYPE( a, atom_type )                                                                              \
-  do                                                                                                                 \
-  {                                                                                                                  \
-    if( !( a )->is_atom( atom_type ) )                                                                               \
-    {                                                                                                                \
-      std::ostringstream os;                                                                                         \
-      os << __FUNCTION__ << " expected " << #a << " to be of type " << atom_type << ", but is " << ( a )->atom.type; \
-      return make_error( os.str().c_str() );                                                                         \
-    }                                                                                                                \
-  } while( 0 )
+Expr * Args::list() const
+{
+  Expr * list = make_nil();
+  for( std::size_t i = size; i > 0; i-- )
+  {
+    list = make_cons( data[i - 1], list );
+  }
+  return list;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -71,30 +45,21 @@ namespace builtin
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_str( Expr * arg, Context & context, const IO & io )
+std::string f_str( Args args )
 {
   std::string str = "";
-  for( Expr * it = arg; it->is_cons(); it = it->cdr() )
+  for( Expr * arg : args )
   {
-    str += to_string( it->car() );
+    str += to_string( arg );
   }
-  return make_string( str.c_str() );
+  return str;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_strtok( Expr * args, Context & context, const IO & io )
+Expr * f_strtok( const char * delim, const char * string )
 {
-  ASSERT_ARG_COUNT( args, 2 );
-
-  Expr * arg_1 = args->car();
-  ASSERT_ARG_TYPE( arg_1, Atom::ATOM_STRING );
-
-  Expr * arg_2 = args->cdr()->car();
-  ASSERT_ARG_TYPE( arg_2, Atom::ATOM_STRING );
-
-  const char * delim = arg_1->as_string();
-  char * str         = STRDUP( arg_2->as_string() );
+  char * str = STRDUP( string );
 
   ListBuilder lb;
   for( char * token = strtok( str, delim ); token != NULL; token = strtok( NULL, delim ) )
@@ -103,39 +68,34 @@ Expr * f_strtok( Expr * args, Context & context, const IO & io )
   }
 
   free( str );
-  return lb.list();
+  return ( lb.list() != nullptr ) ? lb.list() : make_nil();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_strlen( Expr * args, Context & context, const IO & io )
+std::int64_t f_strlen( std::string_view str )
 {
-  ASSERT_ARG_COUNT( args, 1 );
-
-  Expr * arg1 = args->car();
-  ASSERT_ARG_TYPE( arg1, Atom::ATOM_STRING );
-
-  return make_integer( strlen( arg1->as_string() ) );
+  return static_cast<std::int64_t>( str.length() );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_strcmp( Expr * args, Context & context, const IO & io )
+Expr * f_strcmp( std::string_view str1, std::string_view str2, Args rest )
 {
-  ASSERT_MIN_ARG_COUNT( args, 2 );
-
-  Expr * arg_1 = args->car();
-  ASSERT_ARG_TYPE( arg_1, Atom::ATOM_STRING );
-
-  const char * str1 = arg_1->as_string();
+  if( str1 != str2 )
+  {
+    return make_boolean( false );
+  }
 
-  for( Expr * it = args->cdr(); it->is_cons(); it = it->cdr() )
+  for( std::size_t i = 0; i < rest.size; i++ )
   {
-    Expr * arg_n = it->car();
-    ASSERT_ARG_TYPE( arg_n, Atom::ATOM_STRING );
+    Expr * arg_n = rest[i];
+    if( !arg_n->is_string() )
+    {
+      return type_error( "strcmp", i + 2, "a string", arg_n );
+    }
 
-    const char * str2 = arg_n->as_string();
-    if( strcmp( str1, str2 ) != 0 )
+    if( str1 != arg_n->string->view() )
     {
       return make_boolean( false );
     }
@@ -146,491 +106,368 @@ Expr * f_strcmp( Expr * args, Context & context, const IO & io )
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_strip( Expr * args, Context & context, const IO & io )
+std::string_view f_strip( std::string_view string )
 {
-  ASSERT_ARG_COUNT( args, 1 );
-
-  Expr * arg_1 = args->car();
-  ASSERT_ARG_TYPE( arg_1, Atom::ATOM_STRING );
-
-  char * str = STRDUP( arg_1->as_string() );
+  const char * str = string.data();
+  std::size_t end  = string.length();
 
-  char * start = str;
-  while( *start && isspace( *start ) )
+  std::size_t start = 0;
+  while( start < end && isspace( str[start] ) )
   {
     start++;
   }
 
-  char * end = start + strlen( start ) - 1;
-  while( start < end && isspace( *end ) )
+  while( start < end && isspace( str[end - 1] ) )
   {
     end--;
   }
 
-  *( end + 1 ) = '\0';
-
-  Expr * stripped = make_string( start );
-  free( str );
-  return stripped;
+  return string.substr( start, end - start );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_substr( Expr * args, Context & context, const IO & io )
+Expr * f_substr( double from, double to, std::string_view str )
 {
-  ASSERT_ARG_COUNT( args, 3 );
-
-  Expr * arg_1 = args->car();
-  Expr * arg_2 = args->cdr()->car();
-  Expr * arg_3 = args->cdr()->cdr()->car();
-
-  if( !arg_1->is_number() )
-    return make_error( "substr expects arg 1 to be a number" );
-
-  if( !arg_2->is_number() )
-    return make_error( "substr expects arg 2 to be a number" );
-
-  if( !arg_3->is_string() )
-    return make_error( "substr expects arg 3 to be a string" );
-
-  int start  = ( int ) arg_1->as_number();
-  int end    = ( int ) arg_2->as_number();
-  char * str = STRDUP( arg_3->as_string() );
-  int len    = strlen( str );
+  int start = ( int ) from;
+  int end   = ( int ) to;
+  int len   = ( int ) str.length();
 
   if( start < 0 || len < end || start >= end )
     return make_error( "index out of range" );
 
-  str[end] = '\0';
-  str += start;
-
-  Expr * result = make_string( str );
-  free( str );
-  return result;
+  return make_string( str.data() + start, end - start );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_char_at( Expr * args, Context & context, const IO & io )
+Expr * f_char_at( double at, std::string_view string )
 {
-  ASSERT_ARG_COUNT( args, 2 );
-
-  Expr * arg_1 = args->car();
-  if( !arg_1->is_number() )
-    return make_error( "char-at expects number as first arg" );
+  int index = ( int ) at;
 
-  Expr * arg_2 = args->cdr()->car();
-  if( !arg_2->is_string() )
-    return make_error( "char-at exprects string as second arg" );
-
-  int index = ( int ) arg_1->as_number();
-
-  const char * str = arg_2->as_string();
-  int len          = strlen( str );
+  const char * str = string.data();
+  int len          = ( int ) string.length();
 
   if( !( 0 <= index && index < len ) )
     return make_error( "index out-of-bounds" );
 
-  char character[2];
-  character[0] = str[index];
-  character[1] = '\0';
-  return make_string( character );
+  return make_string( str + index, 1 );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_print( Expr * arg, Context & context, const IO & io )
+void f_print( Args args, const IO & io )
 {
-  Expr * str = f_str( arg, context, io );
-  io.out << str->atom.string;
-  return make_void();
+  io.out << f_str( args );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_println( Expr * arg, Context & context, const IO & io )
+void f_println( Args args, const IO & io )
 {
-  ( void ) f_print( arg, context, io );
+  f_print( args, io );
   io.out << std::endl;
-  return make_void();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_to_json( Expr * arg, Context & context, const IO & io )
+std::string f_to_json( Expr * expr )
 {
-  return make_string( arg->car()->to_json().c_str() );
+  return expr->to_json();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_add( Expr * args, Context & context, const IO & io )
+// 'result' = 'a' op 'b', false if it does not fit into an integer
+template <typename Op>
+static bool integer_op( Op, std::int64_t a, std::int64_t b, std::int64_t & result )
 {
-  ASSERT_MIN_ARG_COUNT( args, 2 );
-
-  Expr * arg_1 = args->car();
-  if( !arg_1->is_number() )
+  if constexpr( std::is_same_v<Op, std::plus<>> )
   {
-    return make_error( "expected a number" );
+    return !__builtin_add_overflow( a, b, &result );
   }
-
-  Expr * result = make_copy( arg_1 );
-  for( Expr * it = args->cdr(); it->is_cons(); it = it->cdr() )
+  else if constexpr( std::is_same_v<Op, std::minus<>> )
   {
-    Expr * arg_n = it->car();
-
-    if( !arg_n->is_number() )
-    {
-      return make_error( "expected a number" );
-    }
-
-    if( result->is_integer() && arg_n->is_integer() )
-    {
-      result->atom.integer += arg_n->as_integer();
-    }
-    else
+    return !__builtin_sub_overflow( a, b, &result );
+  }
+  else if constexpr( std::is_same_v<Op, std::multiplies<>> )
+  {
+    return !__builtin_mul_overflow( a, b, &result );
+  }
+  else
+  {
+    if( a == INT64_MIN && b == -1 )
     {
-      if( result->is_integer() )
-      {
-        result = make_real( result->as_number() );
-      }
-      result->atom.real += arg_n->as_number();
+      return false;
     }
+    result = a / b;
+    return true;
   }
-
-  return result;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-
-Expr * f_sub( Expr * args, Context & context, const IO & io )
+static Bignum to_bignum( Expr * integer )
 {
-  ASSERT_MIN_ARG_COUNT( args, 2 );
+  return integer->is_bignum() ? *integer->bignum : Bignum( integer->integer );
+}
 
-  Expr * arg_1 = args->car();
+// folds the numbers with 'op', the result stays an integer for as long as
+// all of them are integers. integers that overflow become bignums
+template <typename Op>
+static Expr * arithmetic( Expr * arg_1, Expr * arg_2, Args rest, Op op )
+{
   if( !arg_1->is_number() )
   {
     return make_error( "expected a number" );
   }
 
-  Expr * result = make_copy( arg_1 );
-  for( Expr * it = args->cdr(); it->is_cons(); it = it->cdr() )
+  // the result is accumulated in one of these, the arguments may be shared
+  // cells
+  enum
   {
-    Expr * arg_n = it->car();
+    INTEGER,
+    BIGNUM,
+    REAL,
+  } kind = arg_1->is_integer() ? INTEGER : ( arg_1->is_bignum() ? BIGNUM : REAL );
+
+  std::int64_t integer = arg_1->is_integer() ? arg_1->integer : 0;
+  Bignum bignum        = arg_1->is_bignum() ? *arg_1->bignum : Bignum();
+  double real          = arg_1->as_number();
+
+  for( std::size_t i = 0; i <= rest.size; i++ )
+  {
+    Expr * arg_n = ( i == 0 ) ? arg_2 : rest[i - 1];
 
     if( !arg_n->is_number() )
     {
       return make_error( "expected a number" );
     }
 
-    if( result->is_integer() && arg_n->is_integer() )
-    {
-      result->atom.integer -= arg_n->as_integer();
-    }
-    else
+    if constexpr( std::is_same_v<Op, std::divides<>> )
     {
-      if( result->is_integer() )
+      if( arg_n->as_number() == 0.0 )
       {
-        result = make_real( result->as_number() );
+        return make_error( "division by zero" );
       }
-      result->atom.real -= arg_n->as_number();
     }
-  }
-  return result;
-}
-
-///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_mul( Expr * args, Context & context, const IO & io )
-{
-  ASSERT_MIN_ARG_COUNT( args, 2 );
-
-  Expr * arg_1 = args->car();
-  if( !arg_1->is_number() )
-  {
-    return make_error( "expected a number" );
-  }
-
-  Expr * result = make_copy( arg_1 );
-  for( Expr * it = args->cdr(); it->is_cons(); it = it->cdr() )
-  {
-    Expr * arg_n = it->car();
-
-    if( !arg_n->is_number() )
+    std::int64_t result;
+    if( kind == INTEGER && arg_n->is_integer() && integer_op( op, integer, arg_n->integer, result ) )
     {
-      return make_error( "expected a number" );
+      integer = result;
+      continue;
     }
 
-    if( result->is_integer() && arg_n->is_integer() )
-    {
-      result->atom.integer *= arg_n->as_integer();
-    }
-    else
+    if( kind != REAL && !arg_n->is_real() )
     {
-      if( result->is_integer() )
+      if( kind == INTEGER )
       {
-        result = make_real( result->as_number() );
+        bignum = Bignum( integer );
+        kind   = BIGNUM;
       }
-      result->atom.real *= arg_n->as_number();
+      bignum = op( bignum, to_bignum( arg_n ) );
+      continue;
+    }
+
+    if( kind != REAL )
+    {
+      real = ( kind == INTEGER ) ? static_cast<double>( integer ) : bignum.to_double();
+      kind = REAL;
     }
+    real = op( real, arg_n->as_number() );
   }
 
-  return result;
+  switch( kind )
+  {
+    case INTEGER :
+      return make_integer( integer );
+    case BIGNUM :
+      return make_bignum( std::move( bignum ) );
+    default :
+      return make_real( real );
+  }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_div( Expr * args, Context & context, const IO & io )
+Expr * f_add( Expr * arg_1, Expr * arg_2, Args rest )
 {
-  ASSERT_MIN_ARG_COUNT( args, 2 );
+  return arithmetic( arg_1, arg_2, rest, std::plus<>() );
+}
 
-  Expr * arg_1 = args->car();
-  if( !arg_1->is_number() )
-  {
-    return make_error( "expected a number" );
-  }
+///////////////////////////////////////////////////////////////////////////////
 
-  Expr * result = make_copy( arg_1 );
-  for( Expr * it = args->cdr(); it->is_cons(); it = it->cdr() )
-  {
-    Expr * arg_n = it->car();
+Expr * f_sub( Expr * arg_1, Expr * arg_2, Args rest )
+{
+  return arithmetic( arg_1, arg_2, rest, std::minus<>() );
+}
 
-    if( !arg_n->is_number() )
-    {
-      return make_error( "expected a number" );
-    }
+///////////////////////////////////////////////////////////////////////////////
 
-    if( arg_n->as_number() == 0.0 )
-    {
-      return make_error( "division by zero" );
-    }
+Expr * f_mul( Expr * arg_1, Expr * arg_2, Args rest )
+{
+  return arithmetic( arg_1, arg_2, rest, std::multiplies<>() );
+}
 
-    if( result->is_integer() && arg_n->is_integer() )
-    {
-      result->atom.integer /= arg_n->as_integer();
-    }
-    else
-    {
-      if( result->is_integer() )
-      {
-        result = make_real( result->as_number() );
-      }
-      result->atom.real /= arg_n->as_number();
-    }
-  }
-  return result;
+///////////////////////////////////////////////////////////////////////////////
+
+Expr * f_div( Expr * arg_1, Expr * arg_2, Args rest )
+{
+  return arithmetic( arg_1, arg_2, rest, std::divides<>() );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_car( Expr * arg, Context & context, const IO & io )
+Expr * f_car( Expr * list )
 {
-  if( !arg->car()->is_cons() )
+  if( !list->is_cons() )
   {
     return make_error( "car expected cons argument" );
   }
-  return arg->car()->car();
+  return list->car();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_cdr( Expr * arg, Context & context, const IO & io )
+Expr * f_cdr( Expr * list )
 {
-  if( !arg->car()->is_cons() )
+  if( !list->is_cons() )
   {
     return make_error( "cdr expected cons argument" );
   }
-  return arg->car()->cdr();
+  return list->cdr();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_cons( Expr * arg, Context & context, const IO & io )
+Expr * f_cons( Expr * car, Expr * cdr )
 {
-  Expr * a = arg->car();
-  Expr * b = arg->cdr()->car();
-  return make_cons( a, b );
+  return make_cons( car, cdr );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_gt( Expr * arg, Context & context, const IO & io )
+// integers and bignums are compared exactly, a real compares as a double
+bool f_gt( Number a, Number b )
 {
-  ASSERT_ARG_COUNT( arg, 2 );
-
-  Expr * arg_1 = arg->car();
-  Expr * arg_2 = arg->cdr()->car();
-
-  if( !( arg_1->is_number() && arg_2->is_number() ) )
-  {
-    return make_error( "expected numbers" );
-  }
-
-  return make_boolean( arg_1->as_number() > arg_2->as_number() );
+  return *a.expr > *b.expr;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_ge( Expr * arg, Context & context, const IO & io )
+bool f_ge( Number a, Number b )
 {
-  ASSERT_ARG_COUNT( arg, 2 );
-
-  Expr * arg_1 = arg->car();
-  Expr * arg_2 = arg->cdr()->car();
-
-  if( !( arg_1->is_number() && arg_2->is_number() ) )
-  {
-    return make_error( "expected numbers" );
-  }
-
-  return make_boolean( arg_1->as_number() >= arg_2->as_number() );
+  return *a.expr > *b.expr || *a.expr == *b.expr;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_lt( Expr * arg, Context & context, const IO & io )
+bool f_lt( Number a, Number b )
 {
-  ASSERT_ARG_COUNT( arg, 2 );
-
-  Expr * arg_1 = arg->car();
-  Expr * arg_2 = arg->cdr()->car();
+  return *b.expr > *a.expr;
+}
 
-  if( !( arg_1->is_number() && arg_2->is_number() ) )
-  {
-    return make_error( "expecting numeric type" );
-  }
+///////////////////////////////////////////////////////////////////////////////
 
-  return make_boolean( arg_1->as_number() < arg_2->as_number() );
+bool f_le( Number a, Number b )
+{
+  return *b.expr > *a.expr || *a.expr == *b.expr;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_le( Expr * arg, Context & context, const IO & io )
+bool f_eq( Args args )
 {
-  Expr * arg_1 = arg->car();
-  Expr * arg_2 = arg->cdr()->car();
-
-  if( !( arg_1->is_number() && arg_2->is_number() ) )
+  bool is_eq = true;
+  for( std::size_t i = 0; is_eq && i + 1 < args.size && args[i]->is_atom(); i++ )
   {
-    return make_error( "atom expected" );
+    is_eq = ( *args[i] == *args[i + 1] );
   }
 
-  return make_boolean( arg_1->as_number() >= arg_2->as_number() );
+  return is_eq;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_eq( Expr * arg, Context & context, const IO & io )
+bool f_not( bool value )
 {
-  Expr * current = arg;
-
-  bool is_eq = true;
-  while( ( is_eq ) && ( current->is_cons() ) && ( current->car()->is_atom() ) && ( !current->cdr()->is_nil() ) )
-  {
-    is_eq   = ( current->car()->atom == current->cdr()->car()->atom );
-    current = current->cdr();
-  }
-
-  return make_boolean( is_eq );
+  return !value;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_not( Expr * arg, Context & context, const IO & io )
+bool f_is_null( Expr * expr )
 {
-  assert( arg->is_cons() );
-  return make_boolean( !( arg->car()->is_truthy() ) );
+  return expr->is_nil();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_is_null( Expr * arg, Context & context, const IO & io )
+bool f_is_real( Expr * expr )
 {
-  assert( arg->is_cons() );
-  return make_boolean( arg->car()->is_nil() );
+  return expr->is_real();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_is_real( Expr * arg, Context & context, const IO & io )
+bool f_is_integer( Expr * expr )
 {
-  assert( arg->is_cons() );
-  return make_boolean( arg->car()->is_real() );
+  return expr->is_integer() || expr->is_bignum();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_is_integer( Expr * arg, Context & context, const IO & io )
+bool f_is_number( Expr * expr )
 {
-  assert( arg->is_cons() );
-  return make_boolean( arg->car()->is_integer() );
+  return expr->is_number();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_is_number( Expr * arg, Context & context, const IO & io )
+bool f_is_string( Expr * expr )
 {
-  assert( arg->is_cons() );
-  return make_boolean( arg->car()->is_number() );
+  return expr->is_string();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_is_string( Expr * arg, Context & context, const IO & io )
+bool f_is_error( Expr * expr )
 {
-  assert( arg->is_cons() );
-  return make_boolean( arg->car()->is_string() );
+  return expr->is_error();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_is_error( Expr * arg, Context & context, const IO & io )
+bool f_is_symbol( Expr * expr )
 {
-  return make_boolean( arg->car()->is_error() );
+  return expr->is_symbol();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_is_symbol( Expr * arg, Context & context, const IO & io )
+Expr * f_eval( Expr * expr, Context & context, const IO & io )
 {
-  assert( arg->is_cons() );
-  return make_boolean( arg->car()->is_symbol() );
+  return eval( expr, context, io );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_eval( Expr * arg, Context & context, const IO & io )
+Expr * f_macroexpand( Expr * form, Context & context, const IO & io )
 {
-  if( !arg->is_cons() )
-  {
-    return make_error( "eval expects a cons" );
-  }
-  return eval( arg->car(), context, io );
+  return macroexpand( form, context, io );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_read( Expr * arg, Context & context, const IO & io )
+Expr * f_read( std::string_view str )
 {
-  if( !( arg->is_cons() && arg->car()->is_string() ) )
-  {
-    return make_error( "read expects a string" );
-  }
-  const char * str = arg->car()->atom.string;
-  Expr * expr      = parse( tokenize( std::string( str ) ) );
+  Expr * expr = parse( tokenize( std::string( str ) ) );
   return expr;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_read_file( Expr * arg, Context & context, const IO & io )
+Expr * f_read_file( const char * filename )
 {
-  if( !( arg->is_cons() && arg->car()->is_string() ) )
-  {
-    return make_error( "read-file expects a string" );
-  }
-
-  const char * filename = arg->car()->atom.string;
   std::ifstream file( filename );
   if( !file.is_open() )
   {
@@ -642,71 +479,51 @@ Expr * f_read_file( Expr * arg, Context & context, const IO & io )
     std::ostringstream ss;
     ss << file.rdbuf();
     std::string content = ss.str();
-    return make_string( content.c_str() );
+    return make_string( content );
   }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_exit( Expr * arg, Context & context, const IO & io )
+void f_exit( Args args, Context & context )
 {
   context.exit = true;
 
-  if( arg->is_cons() && arg->car()->is_real() )
+  if( args.size > 0 && args[0]->is_real() )
   {
-    context.exit_code = ( int ) arg->car()->atom.real;
+    context.exit_code = ( int ) args[0]->real;
   }
   else
   {
     context.exit_code = 0;
   }
-
-  return make_void();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_error( Expr * arg, Context & context, const IO & io )
+Expr * f_error( const char * message )
 {
-  const char * message = arg->car()->as_string();
   return make_error( message );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_list( Expr * arg, Context & context, const IO & io )
+Expr * f_list( Args args )
 {
-  return arg;
+  return args.list();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_append( Expr * args, Context & context, const IO & io )
+Expr * f_append( Expr * list, Expr * rest )
 {
-  Expr * arg1 = args->car();
-  Expr * arg2 = args->cdr()->car();
-
-  if( arg1->is_nil() )
-  {
-    return arg2;
-  }
-
-  Expr * it = nullptr;
-  for( it = arg1; it->cdr()->is_cons(); it = it->cdr() )
-  {
-  }
-
-  it->cons.cdr = arg2;
-
-  return arg1;
+  return splice( list, rest );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_length( Expr * args, Context & context, const IO & io )
+Expr * f_length( Expr * arg1 )
 {
-  Expr * arg1 = args->car();
-
   if( arg1->is_nil() )
   {
     return make_integer( 0 );
@@ -723,17 +540,14 @@ Expr * f_length( Expr * args, Context & context, const IO & io )
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_filter( Expr * arg, Context & context, const IO & io )
+Expr * f_filter( Expr * fn, Expr * list, Context & context, const IO & io )
 {
-  Expr * fn = arg->car();
   if( !fn->is_procedure() )
   {
     return make_error( "filter expects a function as first argument" );
   }
 
   ListBuilder builder;
-
-  Expr * list = arg->cdr()->car();
   for( Expr * it = list; it->is_cons(); it = it->cdr() )
   {
     Expr * el     = it->car();
@@ -750,17 +564,13 @@ Expr * f_filter( Expr * arg, Context & context, const IO & io )
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_map( Expr * arg, Context & context, const IO & io )
+Expr * f_map( Expr * fn, Expr * list, Context & context, const IO & io )
 {
-  Expr * fn = arg->car();
-
   if( !fn->is_procedure() )
   {
     return make_error( "map expects a function as first argument" );
   }
 
-  Expr * list = arg->cdr()->car();
-
   ListBuilder builder;
   for( Expr * it = list; it->is_cons(); it = it->cdr() )
   {
@@ -774,28 +584,26 @@ Expr * f_map( Expr * arg, Context & context, const IO & io )
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_apply( Expr * arg, Context & context, const IO & io )
+Expr * f_apply( Expr * fn, Expr * list, Context & context, const IO & io )
 {
-  Expr * fn = arg->car();
   if( !( fn->is_lambda() || fn->is_native() || fn->is_macro() ) )
   {
     return make_error( "apply expects a function as first argument" );
   }
 
-  Expr * list = arg->cdr()->car();
   Expr * tmp  = make_cons( fn, list );
   return eval( tmp, context, io );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_load( Expr * arg, Context & context, const IO & io )
+Expr * f_load( const char * filename, Context & context, const IO & io )
 {
-  Expr * r = f_read_file( arg, context, io );
+  Expr * r = f_read_file( filename );
   if( r->is_error() )
     return r;
 
-  r = f_read( make_list( r, make_nil() ), context, io );
+  r = f_read( r->string->view() );
   if( r->is_error() )
     return r;
 
@@ -806,24 +614,23 @@ Expr * f_load( Expr * arg, Context & context, const IO & io )
     root = root->parent();
   }
 
-  return f_eval( make_list( r, make_nil() ), *root, io );
+  return f_eval( r, *root, io );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_symbol_name( Expr * arg, Context & context, const IO & io )
+Expr * f_symbol_name( Expr * symbol )
 {
-  Expr * arg1 = arg->car();
-  if( !arg1->is_symbol() )
+  if( !symbol->is_symbol() )
   {
     return make_error( "symbol-name expects a symbol" );
   }
-  return make_string( arg1->atom.symbol );
+  return make_string( symbol->symbol );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * f_dump( Expr * arg, Context & context, const IO & io )
+Expr * f_dump( Args args )
 {
   return make_nil();
 }
@@ -832,16 +639,16 @@ Expr * f_dump( Expr * arg, Context & context, const IO & io )
 
 void load( Context & ctx )
 {
-  ctx.defvar( "+", make_native( builtin::f_add ) );
-  ctx.defvar( "-", make_native( builtin::f_sub ) );
-  ctx.defvar( "*", make_native( builtin::f_mul ) );
-  ctx.defvar( "/", make_native( builtin::f_div ) );
-  ctx.defvar( "=", make_native( builtin::f_eq ) );
-  ctx.defvar( ">", make_native( builtin::f_gt ) );
-  ctx.defvar( ">=", make_native( builtin::f_ge ) );
-  ctx.defvar( "<", make_native( builtin::f_lt ) );
-  ctx.defvar( "<=", make_native( builtin::f_le ) );
-  ctx.defvar( "not", make_native( builtin::f_not ) );
+  defnative<"+", f_add, NATIVE_PURE>( ctx );
+  defnative<"-", f_sub, NATIVE_PURE>( ctx );
+  defnative<"*", f_mul, NATIVE_PURE>( ctx );
+  defnative<"/", f_div, NATIVE_PURE>( ctx );
+  defnative<"=", f_eq, NATIVE_PURE>( ctx );
+  defnative<">", f_gt, NATIVE_PURE>( ctx );
+  defnative<">=", f_ge, NATIVE_PURE>( ctx );
+  defnative<"<", f_lt, NATIVE_PURE>( ctx );
+  defnative<"<=", f_le, NATIVE_PURE>( ctx );
+  defnative<"not", f_not, NATIVE_PURE>( ctx );
   ctx.defvar( KW_NIL, make_symbol( KW_NIL ) );
   ctx.defvar( KW_IF, make_symbol( KW_IF ) );
   ctx.defvar( KW_LAMBDA, make_symbol( KW_LAMBDA ) );
@@ -849,42 +656,43 @@ void load( Context & ctx )
   ctx.defvar( KW_QUOTE, make_symbol( KW_QUOTE ) );
   ctx.defvar( KW_PROGN, make_symbol( KW_PROGN ) );
   ctx.defvar( KW_DEFUN, make_symbol( KW_DEFUN ) );
-  ctx.defvar( "str", make_native( builtin::f_str ) );
-  ctx.defvar( "strtok", make_native( builtin::f_strtok ) );
-  ctx.defvar( "strlen", make_native( builtin::f_strlen ) );
-  ctx.defvar( "strcmp", make_native( builtin::f_strcmp ) );
-  ctx.defvar( "strcat", make_native( builtin::f_str ) );
-  ctx.defvar( "strip", make_native( builtin::f_strip ) );
-  ctx.defvar( "split", make_native( builtin::f_strtok ) );
-  ctx.defvar( "substr", make_native( builtin::f_substr ) );
-  ctx.defvar( "char-at", make_native( builtin::f_char_at ) );
-  ctx.defvar( "print", make_native( builtin::f_print ) );
-  ctx.defvar( "println", make_native( builtin::f_println ) );
-  ctx.defvar( "to-json", make_native( builtin::f_to_json ) );
-  ctx.defvar( KW_CAR, make_native( builtin::f_car ) );
-  ctx.defvar( KW_CDR, make_native( builtin::f_cdr ) );
-  ctx.defvar( KW_CONS, make_native( builtin::f_cons ) );
-  ctx.defvar( KW_APPEND, make_native( builtin::f_append ) );
-  ctx.defvar( "list", make_native( builtin::f_list ) );
-  ctx.defvar( "length", make_native( builtin::f_length ) );
-  ctx.defvar( "read", make_native( builtin::f_read ) );
-  ctx.defvar( "eval", make_native( builtin::f_eval ) );
-  ctx.defvar( "read-file", make_native( builtin::f_read_file ) );
-  ctx.defvar( "exit", make_native( builtin::f_exit ) );
-  ctx.defvar( "error", make_native( builtin::f_error ) );
-  ctx.defvar( "null?", make_native( builtin::f_is_null ) );
-  ctx.defvar( "string?", make_native( builtin::f_is_string ) );
-  ctx.defvar( "error?", make_native( builtin::f_is_error ) );
-  ctx.defvar( "symbol?", make_native( builtin::f_is_symbol ) );
-  ctx.defvar( "real?", make_native( builtin::f_is_real ) );
-  ctx.defvar( "int?", make_native( builtin::f_is_integer ) );
-  ctx.defvar( "number?", make_native( builtin::f_is_number ) );
-  ctx.defvar( "symbol-name", make_native( builtin::f_symbol_name ) );
-  ctx.defvar( "map", make_native( builtin::f_map ) );
-  ctx.defvar( "filter", make_native( builtin::f_filter ) );
-  ctx.defvar( "apply", make_native( builtin::f_apply ) );
-  ctx.defvar( "load", make_native( builtin::f_load ) );
-  ctx.defvar( "dump", make_native( builtin::f_dump ) );
+  defnative<"str", f_str, NATIVE_PURE>( ctx );
+  defnative<"strtok", f_strtok>( ctx );
+  defnative<"strlen", f_strlen, NATIVE_PURE>( ctx );
+  defnative<"strcmp", f_strcmp, NATIVE_PURE>( ctx );
+  defnative<"strcat", f_str, NATIVE_PURE>( ctx );
+  defnative<"strip", f_strip, NATIVE_PURE>( ctx );
+  defnative<"split", f_strtok>( ctx );
+  defnative<"substr", f_substr, NATIVE_PURE>( ctx );
+  defnative<"char-at", f_char_at, NATIVE_PURE>( ctx );
+  defnative<"print", f_print>( ctx );
+  defnative<"println", f_println>( ctx );
+  defnative<"to-json", f_to_json, NATIVE_PURE>( ctx );
+  defnative<KW_CAR, f_car>( ctx );
+  defnative<KW_CDR, f_cdr>( ctx );
+  defnative<KW_CONS, f_cons>( ctx );
+  defnative<KW_APPEND, f_append>( ctx );
+  defnative<"list", f_list>( ctx );
+  defnative<"length", f_length>( ctx );
+  defnative<"read", f_read>( ctx );
+  defnative<"eval", f_eval>( ctx );
+  defnative<"macroexpand", f_macroexpand>( ctx );
+  defnative<"read-file", f_read_file>( ctx );
+  defnative<"exit", f_exit>( ctx );
+  defnative<"error", f_error>( ctx );
+  defnative<"null?", f_is_null, NATIVE_PURE>( ctx );
+  defnative<"string?", f_is_string, NATIVE_PURE>( ctx );
+  defnative<"error?", f_is_error, NATIVE_PURE>( ctx );
+  defnative<"symbol?", f_is_symbol, NATIVE_PURE>( ctx );
+  defnative<"real?", f_is_real, NATIVE_PURE>( ctx );
+  defnative<"int?", f_is_integer, NATIVE_PURE>( ctx );
+  defnative<"number?", f_is_number, NATIVE_PURE>( ctx );
+  defnative<"symbol-name", f_symbol_name, NATIVE_PURE>( ctx );
+  defnative<"map", f_map>( ctx );
+  defnative<"filter", f_filter>( ctx );
+  defnative<"apply", f_apply>( ctx );
+  defnative<"load", f_load>( ctx );
+  defnative<"dump", f_dump>( ctx );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -2,6 +2,11 @@
 
 #include "util.h"
 
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
 namespace lisp
 {
 
@@ -12,98 +17,152 @@ class Context;
 
 ///////////////////////////////////////////////////////////////////////////////
 
-typedef Expr * ( *Native )( Expr *, Context &, const IO & io );
+// the evaluated arguments of a native call. they live on the argument stack
+// and are only valid until the call returns.
+struct Args
+{
+  Expr ** data;
+  std::size_t size;
+
+  Expr * operator[]( std::size_t i ) const
+  {
+    return data[i];
+  }
+
+  Expr ** begin() const
+  {
+    return data;
+  }
+
+  Expr ** end() const
+  {
+    return data + size;
+  }
+
+  // a new list of the arguments
+  Expr * list() const;
+};
+
+// an argument that is checked to be a number, integers and bignums keep their
+// exact value
+struct Number
+{
+  Expr * expr;
+};
+
+typedef Expr * ( *NativeFn )( Args args, Context &, const IO & io );
+
+constexpr std::uint32_t VARIADIC = UINT32_MAX;
+
+// the native has no side effects and its result only depends on its
+// arguments, so calls with constant arguments can be folded
+constexpr std::uint32_t NATIVE_PURE = 1 << 0;
+
+// a native and the number of arguments it accepts, which is checked once
+// before every call. they are generated by defnative() in native.h
+struct NativeDef
+{
+  const char * name;
+  std::uint32_t min_args;
+  std::uint32_t max_args; // VARIADIC if there is no limit
+  NativeFn fn;
+  std::uint32_t flags;
+};
 
 ///////////////////////////////////////////////////////////////////////////////
 
 namespace builtin
 {
 
-Expr * f_str( Expr * arg, Context & context, const IO & io );
+std::string f_str( Args args );
+
+Expr * f_strtok( const char * delim, const char * string );
+
+std::int64_t f_strlen( std::string_view str );
 
-Expr * f_strtok( Expr * arg, Context & context, const IO & io );
+Expr * f_strcmp( std::string_view str1, std::string_view str2, Args rest );
 
-Expr * f_strlen( Expr * arg, Context & context, const IO & io );
+std::string_view f_strip( std::string_view string );
 
-Expr * f_strcmp( Expr * arg, Context & context, const IO & io );
+Expr * f_substr( double from, double to, std::string_view str );
 
-Expr * f_strip( Expr * arg, Context & context, const IO & io );
+Expr * f_char_at( double at, std::string_view string );
 
-Expr * f_substr( Expr * arg, Context & context, const IO & io );
+void f_print( Args args, const IO & io );
 
-Expr * f_char_at( Expr * arg, Context & context, const IO & io );
+void f_println( Args args, const IO & io );
 
-Expr * f_print( Expr * arg, Context & context, const IO & io );
+std::string f_to_json( Expr * expr );
 
-Expr * f_println( Expr * arg, Context & context, const IO & io );
+Expr * f_add( Expr * arg_1, Expr * arg_2, Args rest );
 
-Expr * f_to_json( Expr * arg, Context & context, const IO & io );
+Expr * f_sub( Expr * arg_1, Expr * arg_2, Args rest );
 
-Expr * f_add( Expr * arg, Context & context, const IO & io );
+Expr * f_mul( Expr * arg_1, Expr * arg_2, Args rest );
 
-Expr * f_sub( Expr * arg, Context & context, const IO & io );
+Expr * f_div( Expr * arg_1, Expr * arg_2, Args rest );
 
-Expr * f_mul( Expr * arg, Context & context, const IO & io );
+Expr * f_car( Expr * list );
 
-Expr * f_div( Expr * arg, Context & context, const IO & io );
+Expr * f_cdr( Expr * list );
 
-Expr * f_car( Expr * arg, Context & context, const IO & io );
+Expr * f_cons( Expr * car, Expr * cdr );
 
-Expr * f_cdr( Expr * arg, Context & context, const IO & io );
+bool f_lt( Number a, Number b );
 
-Expr * f_cons( Expr * arg, Context & context, const IO & io );
+bool f_le( Number a, Number b );
 
-Expr * f_lt( Expr * arg, Context & context, const IO & io );
+bool f_gt( Number a, Number b );
 
-Expr * f_le( Expr * arg, Context & context, const IO & io );
+bool f_ge( Number a, Number b );
 
-Expr * f_gt( Expr * arg, Context & context, const IO & io );
+bool f_eq( Args args );
 
-Expr * f_ge( Expr * arg, Context & context, const IO & io );
+bool f_not( bool value );
 
-Expr * f_eq( Expr * arg, Context & context, const IO & io );
+bool f_is_null( Expr * expr );
 
-Expr * f_not( Expr * arg, Context & context, const IO & io );
+bool f_is_real( Expr * expr );
 
-Expr * f_is_null( Expr * arg, Context & context, const IO & io );
+bool f_is_integer( Expr * expr );
 
-Expr * f_is_real( Expr * arg, Context & context, const IO & io );
+bool f_is_number( Expr * expr );
 
-Expr * f_is_integer( Expr * arg, Context & context, const IO & io );
+bool f_is_string( Expr * expr );
 
-Expr * f_is_number( Expr * arg, Context & context, const IO & io );
+bool f_is_error( Expr * expr );
 
-Expr * f_is_string( Expr * arg, Context & context, const IO & io );
+bool f_is_symbol( Expr * expr );
 
-Expr * f_is_error( Expr * arg, Context & context, const IO & io );
+Expr * f_eval( Expr * expr, Context & context, const IO & io );
 
-Expr * f_is_symbol( Expr * arg, Context & context, const IO & io );
+Expr * f_macroexpand( Expr * form, Context & context, const IO & io );
 
-Expr * f_eval( Expr * arg, Context & context, const IO & io );
+Expr * f_read( std::string_view str );
 
-Expr * f_read( Expr * arg, Context & context, const IO & io );
+Expr * f_read_file( const char * filename );
 
-Expr * f_read_file( Expr * arg, Context & context, const IO & io );
+void f_exit( Args args, Context & context );
 
-Expr * f_exit( Expr * arg, Context & context, const IO & io );
+Expr * f_error( const char * message );
 
-Expr * f_error( Expr * arg, Context & context, const IO & io );
+Expr * f_list( Args args );
 
-Expr * f_list( Expr * arg, Context & context, const IO & io );
+Expr * f_append( Expr * list, Expr * rest );
 
-Expr * f_append( Expr * arg, Context & context, const IO & io );
+Expr * f_length( Expr * list );
 
-Expr * f_length( Expr * arg, Context & context, const IO & io );
+Expr * f_filter( Expr * fn, Expr * list, Context & context, const IO & io );
 
-Expr * f_filter( Expr * arg, Context & context, const IO & io );
+Expr * f_map( Expr * fn, Expr * list, Context & context, const IO & io );
 
-Expr * f_map( Expr * arg, Context & context, const IO & io );
+Expr * f_apply( Expr * fn, Expr * list, Context & context, const IO & io );
 
-Expr * f_apply( Expr * arg, Context & context, const IO & io );
+Expr * f_load( const char * filename, Context & context, const IO & io );
 
-Expr * f_load( Expr * arg, Context & context, const IO & io );
+Expr * f_symbol_name( Expr * symbol );
 
-Expr * f_symbol_name( Expr * arg, Context & context, const IO & io );
+Expr * f_dump( Args args );
 
 void load( Context & context );
 
@@ -1,4 +1,5 @@
 #include "eval.h"
+#include "analyze.h"
 #include "builtin.h"
 #include "expr.h"
 #include "gc.h"
@@ -8,17 +9,26 @@
 #include "shell.h"
 #endif
 #include "logger.h"
+#include "optimize.h"
 #include "parser.h"
 #include "tokenizer.h"
+#include "vm.h"
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <cstdio>
+#include <exception>
 #include <fstream>
 #include <iomanip>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #ifdef __linux__
+#include <pthread.h>
 #include <readline/history.h>
 #include <readline/readline.h>
 #endif
@@ -28,16 +38,379 @@ namespace lisp
 
 ///////////////////////////////////////////////////////////////////////////////
 
+static Engine current_engine = ENGINE_CLOSURE;
+
+void set_engine( Engine e )
+{
+  current_engine = e;
+}
+
+Engine engine()
+{
+  return current_engine;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// call frames that no closure can capture live on this stack instead of the
+// heap. they are kept in fixed size chunks, so that they never move.
+class Frames
+{
+public:
+  ~Frames()
+  {
+    pop( 0 );
+    for( std::size_t i = 0; i < m_constructed; i++ )
+    {
+      at( i )->~Context();
+    }
+    for( Context * chunk : m_chunks )
+    {
+      ::operator delete( chunk );
+    }
+  }
+
+  // frames are constructed once and reused, so that their slots keep their
+  // capacity from call to call
+  Context * push( Context * parent )
+  {
+    if( m_height == m_constructed )
+    {
+      if( m_constructed == m_chunks.size() * CHUNK_SIZE )
+      {
+        m_chunks.push_back( static_cast<Context *>( ::operator new( CHUNK_SIZE * sizeof( Context ) ) ) );
+      }
+
+      Context * frame = new( at( m_constructed++ ) ) Context( parent );
+      frame->m_frame  = true;
+      gc::add_static( frame );
+    }
+
+    Context * frame   = at( m_height++ );
+    frame->m_parent   = parent;
+    frame->m_promoted = nullptr;
+    frame->m_dynamic  = false;
+    return frame;
+  }
+
+  void pop( std::size_t height )
+  {
+    while( m_height > height )
+    {
+      at( --m_height )->m_slots.clear();
+    }
+  }
+
+  std::size_t height() const
+  {
+    return m_height;
+  }
+
+  void mark()
+  {
+    for( std::size_t i = 0; i < m_height; i++ )
+    {
+      at( i )->mark();
+    }
+  }
+
+private:
+  static constexpr std::size_t CHUNK_SIZE = 256;
+
+  std::vector<Context *> m_chunks;
+  std::size_t m_height      = 0;
+  std::size_t m_constructed = 0;
+
+  Context * at( std::size_t index ) const
+  {
+    return m_chunks[index / CHUNK_SIZE] + index % CHUNK_SIZE;
+  }
+};
+
+static Frames frames;
+
+Context * push_frame( Context * parent )
+{
+  return frames.push( parent );
+}
+
+void pop_frames( std::size_t height )
+{
+  frames.pop( height );
+}
+
+std::size_t frame_height()
+{
+  return frames.height();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// the evaluated arguments of calls. they are kept in blocks that never move,
+// so that the span a native receives stays valid while it evaluates more code.
+class Arguments
+{
+public:
+  ~Arguments()
+  {
+    for( Block & block : m_blocks )
+    {
+      delete[] block.data;
+    }
+  }
+
+  // a span of 'n' arguments, they start out as nullptr
+  Expr ** push( std::size_t n )
+  {
+    if( m_blocks.empty() || m_top + n > m_blocks[m_current].size )
+    {
+      next( n );
+    }
+
+    Expr ** span = m_blocks[m_current].data + m_top;
+    std::fill_n( span, n, nullptr );
+    m_top += n;
+    return span;
+  }
+
+  // drops 'span' and everything that was pushed after it
+  void pop( Expr ** span )
+  {
+    while( !contains( m_blocks[m_current], span ) )
+    {
+      m_current--;
+    }
+    m_top = static_cast<std::size_t>( span - m_blocks[m_current].data );
+  }
+
+  void mark()
+  {
+    for( std::size_t i = 0; i < m_blocks.size() && i <= m_current; i++ )
+    {
+      std::size_t used = ( i == m_current ) ? m_top : m_blocks[i].used;
+      for( std::size_t j = 0; j < used; j++ )
+      {
+        gc::mark( m_blocks[i].data[j] );
+      }
+    }
+  }
+
+private:
+  static constexpr std::size_t BLOCK_SIZE = 4096;
+
+  struct Block
+  {
+    Expr ** data;
+    std::size_t size;
+    std::size_t used; // while a later block is on top
+  };
+
+  std::vector<Block> m_blocks;
+  std::size_t m_current = 0;
+  std::size_t m_top     = 0;
+
+  static bool contains( const Block & block, Expr ** span )
+  {
+    return std::less_equal<Expr **>()( block.data, span ) && std::less_equal<Expr **>()( span, block.data + block.size );
+  }
+
+  // continues in the next block, which has to hold at least 'n' arguments
+  void next( std::size_t n )
+  {
+    if( !m_blocks.empty() )
+    {
+      m_blocks[m_current].used = m_top;
+      m_current++;
+    }
+
+    if( m_current == m_blocks.size() )
+    {
+      std::size_t size = std::max( BLOCK_SIZE, n );
+      m_blocks.push_back( Block{ new Expr *[size], size, 0 } );
+    }
+    else if( m_blocks[m_current].size < n )
+    {
+      delete[] m_blocks[m_current].data;
+      m_blocks[m_current].data = new Expr *[n];
+      m_blocks[m_current].size = n;
+    }
+    m_top = 0;
+  }
+};
+
+static Arguments arguments;
+
+Expr ** push_arguments( std::size_t n )
+{
+  return arguments.push( n );
+}
+
+void pop_arguments( Expr ** span )
+{
+  arguments.pop( span );
+}
+
+static Expr * arity_error( const NativeDef * native, std::size_t argc )
+{
+  std::ostringstream os;
+  os << native->name << " expected ";
+  if( native->min_args == native->max_args )
+  {
+    os << native->min_args;
+  }
+  else if( native->max_args == VARIADIC )
+  {
+    os << "at least " << native->min_args;
+  }
+  else
+  {
+    os << native->min_args << " to " << native->max_args;
+  }
+  os << " args but received " << argc;
+  return make_error( os.str().c_str() );
+}
+
+Expr * type_error( const char * name, std::size_t index, const char * expected, Expr * arg )
+{
+  std::ostringstream os;
+  os << name << " expected " << expected << " as argument " << ( index + 1 ) << " but received " << to_string_repr( arg );
+  return make_error( os.str().c_str() );
+}
+
+Expr * call_native( Expr * fn, Args args, Context & context, const IO & io )
+{
+  const NativeDef * native = fn->native;
+  if( args.size < native->min_args || args.size > native->max_args )
+  {
+    return arity_error( native, args.size );
+  }
+  return native->fn( args, context, io );
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
+// pops the frames pushed by one activation of eval
+struct FrameScope
+{
+  const std::size_t height = frames.height();
+
+  ~FrameScope()
+  {
+    frames.pop( height );
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+// the engines recurse on the C++ stack, so programs are evaluated on a stack
+// at least as large as the stack budget. an evaluation that would grow
+// beyond it is abandoned with a stack-overflow error.
+static std::size_t stack_budget_bytes = DEFAULT_STACK_BUDGET;
+
+// the lowest address the evaluator may use, nullptr while no program runs
+static char * stack_limit = nullptr;
+
+// thrown by abandon(), it unwinds to the outermost eval_program()
+struct Abandon
+{
+  const char * message;
+};
+
+void set_stack_budget( std::size_t bytes )
+{
+  stack_budget_bytes = bytes;
+}
+
+std::size_t stack_budget()
+{
+  return stack_budget_bytes;
+}
+
+void abandon( const char * message )
+{
+  throw Abandon{ message };
+}
+
+void check_stack()
+{
+#ifdef __linux__
+  if( static_cast<char *>( __builtin_frame_address( 0 ) ) < stack_limit )
+  {
+    abandon( "stack-overflow" );
+  }
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// steps are counted down in batches, the budget and the deadline are only
+// checked once a batch is used up
+constexpr std::uint64_t BUDGET_BATCH = 4096;
+
+std::uint64_t budget_ticks = BUDGET_BATCH;
+
+static std::uint64_t budget_steps = UINT64_MAX; // the steps left after this batch
+static std::chrono::steady_clock::time_point budget_deadline = std::chrono::steady_clock::time_point::max();
+
+static void start_budget( const Budget & budget )
+{
+  budget_steps    = ( budget.steps != 0 ) ? budget.steps : UINT64_MAX;
+  budget_deadline = budget.deadline;
+  budget_ticks    = 1;
+  gc::set_heap_limit( budget.heap );
+  check_budget();
+}
+
+static void stop_budget()
+{
+  budget_steps    = UINT64_MAX;
+  budget_deadline = std::chrono::steady_clock::time_point::max();
+  budget_ticks    = BUDGET_BATCH;
+  gc::set_heap_limit( 0 );
+}
+
+void check_budget()
+{
+  if( budget_steps == 0 )
+  {
+    abandon( "out-of-steps" );
+  }
+  if( budget_deadline != std::chrono::steady_clock::time_point::max() &&
+      std::chrono::steady_clock::now() >= budget_deadline )
+  {
+    abandon( "out-of-time" );
+  }
+
+  budget_ticks = std::min( budget_steps, BUDGET_BATCH );
+  budget_steps -= budget_ticks;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// global caches remember slots of one root, every root that comes or goes
+// and every name a frame binds without declaring it starts over
+static std::uint32_t globals_version = 1;
+
+static std::unordered_set<const Expr *> frame_bound;
+
+bool is_frame_bound( const Expr * symbol )
+{
+  return frame_bound.count( symbol ) != 0;
+}
+
 Context::Context( Context * parent )
     : gc::Garbage()
     , exit( false )
     , exit_code( false )
     , m_parent( parent )
+    , m_promoted( nullptr )
+    , m_frame( false )
+    , m_dynamic( false )
 {
   if( is_root() )
   {
+    globals_version++;
+    gc::add_root( this );
     builtin::load( *this );
 #if defined( __linux__ )
     shell::load( *this );
@@ -50,77 +423,269 @@ Context::Context( Context * parent )
 Context::~Context()
 {
   m_env.clear();
-#if 0
-   if( m_parent == nullptr )
-   {
-      gc::run( *this );
-   }
-#endif
 
-#if 1
   if( is_root() )
   {
-    gc::delete_all();
+    globals_version++;
+    gc::remove_root( this );
+    if( !gc::has_roots() )
+    {
+      gc::delete_all();
+    }
   }
-#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
 Expr * Context::lookup( const char * symbol ) const
 {
-  std::string key( symbol );
-  auto it = m_env.find( key );
-  if( it != m_env.end() )
+  return lookup( make_symbol( symbol ) );
+}
+
+Expr * Context::lookup( Expr * symbol ) const
+{
+  for( const Context * context = this; context != nullptr; context = context->m_parent )
   {
-    return it->second;
+    if( context->m_promoted != nullptr )
+    {
+      context = context->m_promoted;
+    }
+
+    if( context->is_root() )
+    {
+      auto it = context->m_env.find( symbol );
+      if( it != context->m_env.end() )
+      {
+        return context->m_slots[it->second].value;
+      }
+    }
+    else
+    {
+      for( const Slot & slot : context->m_slots )
+      {
+        if( slot.symbol == symbol && slot.value != nullptr )
+        {
+          return slot.value;
+        }
+      }
+    }
+  }
+
+  std::string msg = "undefined symbol '" + std::string( symbol->symbol ) + "'";
+  return make_error( msg.c_str() );
+}
+
+Expr * Context::lookup( std::uint32_t depth, std::uint32_t slot, Expr * symbol ) const
+{
+  const Context * context = this;
+  while( true )
+  {
+    if( context->m_promoted != nullptr )
+    {
+      context = context->m_promoted;
+    }
+
+    if( depth == 0 )
+    {
+      break;
+    }
+
+    if( context->m_dynamic || context->is_root() )
+    {
+      return lookup( symbol );
+    }
+
+    context = context->m_parent;
+    depth--;
+  }
+
+  if( slot < context->m_slots.size() )
+  {
+    const Slot & s = context->m_slots[slot];
+    if( s.symbol == symbol && s.value != nullptr )
+    {
+      return s.value;
+    }
+  }
+  return lookup( symbol );
+}
+
+Expr * Context::lookup( Expr * symbol, GlobalCache & cache ) const
+{
+  if( cache.version == globals_version )
+  {
+    return cache.root->m_slots[cache.slot].value;
+  }
+
+  if( is_frame_bound( symbol ) )
+  {
+    return lookup( symbol );
+  }
+
+  const Context * context = this;
+  while( context->m_parent != nullptr )
+  {
+    context = context->m_parent;
+  }
+
+  auto it = context->m_env.find( symbol );
+  if( it == context->m_env.end() )
+  {
+    return lookup( symbol );
+  }
+  cache.version = globals_version;
+  cache.slot    = it->second;
+  cache.root    = context;
+  return context->m_slots[cache.slot].value;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void Context::defvar( const char * symbol, Expr * expr )
+{
+  defvar( make_symbol( symbol ), expr );
+}
+
+void Context::defvar( Expr * symbol, Expr * expr )
+{
+  if( m_promoted != nullptr )
+  {
+    m_promoted->defvar( symbol, expr );
+    return;
+  }
+
+  if( is_root() )
+  {
+    auto [it, inserted] = m_env.try_emplace( symbol, static_cast<std::uint32_t>( m_slots.size() ) );
+    if( inserted )
+    {
+      m_slots.push_back( Slot{ symbol, expr } );
+    }
+    else
+    {
+      m_slots[it->second].value = expr;
+    }
   }
   else
   {
-    if( m_parent != nullptr )
+    auto it = std::find_if( m_slots.begin(), m_slots.end(), [symbol]( const Slot & s ) { return s.symbol == symbol; } );
+    if( it != m_slots.end() )
     {
-      return m_parent->lookup( symbol );
+      it->value = expr;
     }
     else
     {
-      std::string msg = "undefined symbol '" + std::string( symbol ) + "'";
-      return make_error( msg.c_str() );
+      m_slots.push_back( Slot{ symbol, expr } );
+      m_dynamic = true;
+      if( frame_bound.insert( symbol ).second )
+      {
+        globals_version++;
+      }
     }
   }
+  gc::write_barrier( this, expr );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-void Context::defvar( const char * symbol, Expr * expr )
+void Context::declare( Expr * symbol )
 {
-  std::string key( symbol );
-  m_env[key] = expr;
+  for( const Slot & slot : m_slots )
+  {
+    if( slot.symbol == symbol )
+    {
+      return;
+    }
+  }
+  m_slots.push_back( Slot{ symbol, nullptr } );
+}
+
+void Context::declare_params( Expr * params )
+{
+  for( ; params->is_cons(); params = params->cdr() )
+  {
+    if( !is_rest_param( params->car() ) )
+    {
+      declare( params->car() );
+    }
+  }
+}
+
+void Context::declare_bindings( Expr * bindings )
+{
+  for( ; bindings->is_cons(); bindings = bindings->cdr() )
+  {
+    declare( bindings->car()->car() );
+  }
+}
+
+bool is_rest_param( Expr * param )
+{
+  return param->is_symbol() && strncmp( param->symbol, "&rest", 5 ) == 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-void Context::print( const IO & io ) const
+Context * Context::promote()
 {
-  for( auto it = m_env.begin(); it != m_env.end(); it++ )
+  if( !m_frame )
   {
-    io.out << it->first << " : " << to_string_repr( it->second ) << std::endl;
+    return this;
   }
+
+  if( m_promoted == nullptr )
+  {
+    m_promoted            = gc::alloc<Context>( m_parent->promote() );
+    m_promoted->m_slots   = std::move( m_slots );
+    m_promoted->m_dynamic = m_dynamic;
+    for( const Slot & slot : m_promoted->m_slots )
+    {
+      gc::write_barrier( m_promoted, slot.value );
+    }
+    m_slots.clear();
+  }
+  return m_promoted;
+}
+
+bool Context::is_frame() const
+{
+  return m_frame;
 }
 
-const Env & Context::env() const
+///////////////////////////////////////////////////////////////////////////////
+
+void Context::print( const IO & io ) const
 {
-  return m_env;
+  if( m_promoted != nullptr )
+  {
+    m_promoted->print( io );
+    return;
+  }
+
+  for( const Slot & slot : m_slots )
+  {
+    if( slot.value != nullptr )
+    {
+      io.out << slot.symbol->symbol << " : " << to_string_repr( slot.value ) << std::endl;
+    }
+  }
 }
 
 void Context::mark()
 {
-  set_marked( true );
-#if 0
-   for( const auto & [_, expr] : m_env )
-   {
-      expr->mark();
-   }
-#endif
+  if( is_root() )
+  {
+    frames.mark();
+    arguments.mark();
+    vm::mark();
+  }
+
+  gc::mark( m_parent );
+  gc::mark( m_promoted );
+  for( const Slot & slot : m_slots )
+  {
+    gc::mark( slot.value );
+  }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -189,38 +754,230 @@ void init( Context & context, const IO & io )
 Expr * eval_atom( Expr * expr, Context & context, const IO & io )
 {
   assert( expr->is_atom() );
-  switch( expr->atom.type )
+  if( expr->is_symbol() )
   {
-    case Atom::ATOM_NIL :
-    case Atom::ATOM_BOOLEAN :
-    case Atom::ATOM_REAL :
-    case Atom::ATOM_INTEGER :
-    case Atom::ATOM_STRING :
-    case Atom::ATOM_ERROR :
-    case Atom::ATOM_LAMBDA :
-    case Atom::ATOM_MACRO :
-    case Atom::ATOM_NATIVE :
-      return expr;
-    case Atom::ATOM_SYMBOL :
-      return context.lookup( expr->atom.symbol );
+    return context.lookup( expr );
   }
-  UNREACHABLE
-  return make_nil();
+  return expr;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Expr * eval_program( Expr * program, Context & context, const IO & io )
+static Expr * eval_forms( Expr * program, Context & context, const IO & io )
 {
-  Expr * result = make_nil();
+  const Scope * scope = context.is_root() ? Scope::root() : nullptr;
+  Expr * result       = make_nil();
   for( ; program->is_cons(); program = program->cdr() )
   {
-    Expr * expr = program->car();
-    result      = eval( expr, context, io );
+    Expr * expr = optimize( program->car(), context, io );
+    if( current_engine == ENGINE_CLOSURE )
+    {
+      result = exec( analyze( expr, scope ), context, io );
+    }
+    else if( current_engine == ENGINE_VM )
+    {
+      result = vm::run( vm::compile( analyze( expr, scope ) ), context, io );
+    }
+    else
+    {
+      result = eval( expr, context, io );
+    }
   }
   return result;
 }
 
+// true while the outermost eval_program() runs, the ones it calls neither
+// start over on a stack of their own nor catch what abandons it
+static bool program_running = false;
+
+// an evaluation of a program on the evaluation stack
+struct ProgramRun
+{
+  Expr * program;
+  Context * context;
+  const IO * io;
+  Expr * result;
+  std::exception_ptr exception;
+};
+
+static void run_program( ProgramRun * run )
+{
+  std::size_t height = frames.height();
+  Expr ** bottom     = arguments.push( 0 );
+  program_running    = true;
+  try
+  {
+    start_budget( run->io->budget );
+    run->result = eval_forms( run->program, *run->context, *run->io );
+  }
+  catch( const Abandon & abandoned )
+  {
+    // what the unwound activations left on the stacks of the engines, the
+    // error itself may need the heap the budget denied
+    stop_budget();
+    frames.pop( height );
+    vm::reset();
+    run->result = make_error( abandoned.message );
+  }
+  catch( const gc::HeapLimitExceeded & )
+  {
+    stop_budget();
+    frames.pop( height );
+    vm::reset();
+    run->result = make_error( "out-of-memory" );
+  }
+  catch( ... )
+  {
+    stop_budget();
+    frames.pop( height );
+    vm::reset();
+    run->exception = std::current_exception();
+  }
+  stop_budget();
+  program_running = false;
+  arguments.pop( bottom );
+}
+
+#ifdef __linux__
+
+// some room for what runs below the last check, e.g. natives
+constexpr std::size_t STACK_RESERVE = 1 << 20;
+
+static void run_on_this_stack( ProgramRun * run )
+{
+  stack_limit = static_cast<char *>( __builtin_frame_address( 0 ) ) - stack_budget_bytes;
+  run_program( run );
+  stack_limit = nullptr;
+}
+
+// the bytes left on the stack of the calling thread
+static std::size_t stack_room()
+{
+  static thread_local char * bottom = nullptr;
+  if( bottom == nullptr )
+  {
+    pthread_attr_t attr;
+    void * addr;
+    std::size_t size;
+    pthread_getattr_np( pthread_self(), &attr );
+    pthread_attr_getstack( &attr, &addr, &size );
+    pthread_attr_destroy( &attr );
+    bottom = static_cast<char *>( addr );
+  }
+  return static_cast<std::size_t>( static_cast<char *>( __builtin_frame_address( 0 ) ) - bottom );
+}
+
+// the thread that runs the programs whose callers lack the stack for them.
+// it is started by the first of them and waits for the next one in between,
+// it is only started over when the stack budget outgrows its stack.
+struct ProgramThread
+{
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  pthread_t thread;
+  std::size_t stack_size = 0;
+  ProgramRun * run       = nullptr;
+  bool stop              = false;
+};
+
+// never destroyed, the thread still waits on it when the process exits
+static ProgramThread & program_thread = *new ProgramThread;
+
+static void * program_thread_main( void * )
+{
+  std::unique_lock<std::mutex> lock( program_thread.mutex );
+  for( ;; )
+  {
+    program_thread.wake.wait( lock, [] { return program_thread.run != nullptr || program_thread.stop; } );
+    if( program_thread.stop )
+    {
+      return nullptr;
+    }
+
+    lock.unlock();
+    run_on_this_stack( program_thread.run );
+    lock.lock();
+    program_thread.run = nullptr;
+    program_thread.done.notify_one();
+  }
+}
+
+static bool start_program_thread( std::size_t stack_size )
+{
+  if( program_thread.stack_size != 0 )
+  {
+    {
+      std::lock_guard<std::mutex> lock( program_thread.mutex );
+      program_thread.stop = true;
+    }
+    program_thread.wake.notify_one();
+    pthread_join( program_thread.thread, nullptr );
+    program_thread.stop       = false;
+    program_thread.stack_size = 0;
+  }
+
+  pthread_attr_t attr;
+  pthread_attr_init( &attr );
+  pthread_attr_setstacksize( &attr, stack_size );
+  bool started = pthread_create( &program_thread.thread, &attr, program_thread_main, nullptr ) == 0;
+  pthread_attr_destroy( &attr );
+
+  if( started )
+  {
+    program_thread.stack_size = stack_size;
+  }
+  return started;
+}
+
+static void run_on_program_thread( void * arg )
+{
+  auto run = static_cast<ProgramRun *>( arg );
+
+  std::size_t stack_size = stack_budget_bytes + STACK_RESERVE;
+  if( program_thread.stack_size < stack_size && !start_program_thread( stack_size ) )
+  {
+    run->exception = std::make_exception_ptr( std::bad_alloc() );
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock( program_thread.mutex );
+  program_thread.run = run;
+  program_thread.wake.notify_one();
+  program_thread.done.wait( lock, [] { return program_thread.run == nullptr; } );
+}
+
+#endif
+
+Expr * eval_program( Expr * program, Context & context, const IO & io )
+{
+  if( program_running )
+  {
+    return eval_forms( program, context, io );
+  }
+
+  ProgramRun run = { program, &context, &io, nullptr, nullptr };
+#ifdef __linux__
+  if( stack_room() >= stack_budget_bytes + STACK_RESERVE )
+  {
+    run_on_this_stack( &run );
+  }
+  else
+  {
+    // the thread that waits holds values the collector must see
+    gc::park_stack( run_on_program_thread, &run );
+  }
+#else
+  run_program( &run );
+#endif
+
+  if( run.exception )
+  {
+    std::rethrow_exception( run.exception );
+  }
+  return run.result;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 Expr * eval_list( Expr * expr, Context & context, const IO & io )
@@ -230,30 +987,35 @@ Expr * eval_list( Expr * expr, Context & context, const IO & io )
     return make_void();
   }
 
-  if( ( expr->type == Expr::EXPR_ATOM && expr->atom.type == Atom::ATOM_NIL ) )
+  if( expr->type == Expr::EXPR_NIL )
   {
     return make_nil();
   }
 
-  Expr * first = eval( expr->car(), context, io );
-  Expr * rest  = eval_list( expr->cdr(), context, io );
-  return make_cons( first, rest );
+  ListBuilder builder;
+  for( ; expr->is_cons(); expr = expr->cdr() )
+  {
+    builder.append( eval( expr->car(), context, io ) );
+  }
+  return ( builder.list() != nullptr ) ? builder.list() : make_nil();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
 void bind_params( Context * local, Expr * params, Expr * args )
 {
+  local->declare_params( params );
+
   Expr *arg, *param;
   for( arg = args, param = params; param->is_cons() && arg->is_cons(); arg = arg->cdr(), param = param->cdr() )
   {
-    const char * symbol = param->car()->as_symbol();
-    assert( symbol != nullptr );
+    Expr * symbol = param->car();
+    assert( symbol->is_symbol() );
 
-    if( strncmp( symbol, "&rest", 5 ) == 0 )
+    if( is_rest_param( symbol ) )
     {
-      const char * next_symbol = param->cdr()->car()->as_symbol();
-      assert( next_symbol != nullptr );
+      Expr * next_symbol = param->cdr()->car();
+      assert( next_symbol->is_symbol() );
       local->defvar( next_symbol, arg );
       break;
     }
@@ -262,6 +1024,67 @@ void bind_params( Context * local, Expr * params, Expr * args )
   }
 }
 
+void bind_params( Context * local, Expr * params, Expr ** args, std::size_t argc )
+{
+  local->declare_params( params );
+
+  std::size_t i = 0;
+  for( Expr * param = params; param->is_cons() && i < argc; param = param->cdr(), i++ )
+  {
+    Expr * symbol = param->car();
+    assert( symbol->is_symbol() );
+
+    if( is_rest_param( symbol ) )
+    {
+      Expr * next_symbol = param->cdr()->car();
+      assert( next_symbol->is_symbol() );
+      local->defvar( next_symbol, Args{ args + i, argc - i }.list() );
+      break;
+    }
+
+    local->defvar( symbol, args[i] );
+  }
+}
+
+Expr * macroexpand( Expr * form, Context & context, const IO & io )
+{
+  while( form->is_cons() && form->car()->is_symbol() )
+  {
+    Expr * fn = context.lookup( form->car() );
+    if( !fn->is_macro() )
+    {
+      break;
+    }
+
+    std::size_t height = frames.height();
+    Context * new_env  = frames.push( &context );
+    bind_params( new_env, fn->macro->params, form->cdr() );
+    form = eval( fn->macro->body->car(), *new_env, io );
+    frames.pop( height );
+  }
+  return form;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+Expr * splice( Expr * list, Expr * rest )
+{
+  if( list->is_nil() )
+  {
+    return rest;
+  }
+
+  Expr * it = nullptr;
+  for( it = list; it->cdr()->is_cons(); it = it->cdr() )
+  {
+  }
+
+  it->cons.cdr = rest;
+  gc::write_barrier( it, rest );
+
+  return list;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 Expr * expand( Expr * ast )
@@ -271,7 +1094,7 @@ Expr * expand( Expr * ast )
     Expr * car = ast->car();
     Expr * cdr = ast->cdr();
 
-    if( car->is_cons() && car->car()->is_symbol( KW_UNQUOTE ) )
+    if( car->is_cons() && car->car()->is_symbol( SYM_UNQUOTE ) )
     {
       Expr * sy       = make_symbol( KW_CONS );
       Expr * unquoted = car->cdr()->car();
@@ -279,7 +1102,7 @@ Expr * expand( Expr * ast )
       return make_list( sy, unquoted, rest );
     }
 
-    if( car->is_cons() && car->car()->is_symbol( KW_UNQUOTE_SPLICE ) )
+    if( car->is_cons() && car->car()->is_symbol( SYM_UNQUOTE_SPLICE ) )
     {
       Expr * sy       = make_symbol( KW_APPEND );
       Expr * unquoted = car->cdr()->car();
@@ -306,283 +1129,695 @@ Expr * expand( Expr * ast )
 
 ///////////////////////////////////////////////////////////////////////////////
 
+// lambdas and macros are analyzed when they are first called
+static Node * lambda_code( Expr * fn )
+{
+  Lambda * lambda = fn->lambda;
+  if( lambda->code == nullptr )
+  {
+    const Scope * scope = lambda->env->is_root() ? Scope::root() : nullptr;
+    lambda->code        = analyze_body( lambda->params, lambda->body->car(), scope );
+    gc::write_barrier( fn, lambda->code );
+  }
+  return lambda->code;
+}
+
+static Node * macro_code( Expr * fn )
+{
+  Macro * macro = fn->macro;
+  if( macro->code == nullptr )
+  {
+    macro->code = analyze_body( macro->params, macro->body->car() );
+    gc::write_barrier( fn, macro->code );
+  }
+  return macro->code;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// the (var init) of a dotimes or dolist
+static bool is_loop_head( Expr * head )
+{
+  return head->is_cons() && head->car()->is_symbol() && head->cdr()->is_cons();
+}
+
+// the forms of a loop body are evaluated for their effects
+static void eval_body( Expr * body, Context & context, const IO & io )
+{
+  for( ; body->is_cons(); body = body->cdr() )
+  {
+    ( void ) eval( body->car(), context, io );
+  }
+}
+
+#ifdef __linux__
+
+// the shell forms live out of line, their buffers would otherwise enlarge
+// every activation of eval()
+static Expr * eval_to_stream( Expr * args, Context * context, const IO & io )
+{
+  Expr * r         = eval( args, *context, io );
+  std::string data = to_string( r );
+
+  ssize_t n;
+  ssize_t total = 0;
+
+  while( total < ( ssize_t ) data.size() )
+  {
+    n = write( io.pipe_stdout, data.data() + total, data.size() - total );
+    if( n < 0 )
+    {
+      break;
+    }
+    total += n;
+  }
+
+  if( io.pipe_stdout != STDOUT_FILENO )
+  {
+    close( io.pipe_stdout );
+  }
+  return make_void();
+}
+
+static Expr * eval_from_stream( Expr * args, Context * context, const IO & io )
+{
+  int fds[2];
+  pipe( fds );
+
+  IO local_io;
+  local_io.pipe_stdin  = io.pipe_stdin;
+  local_io.pipe_stdout = fds[1];
+
+  Expr * r = eval( args, *context, local_io );
+  if( r->is_error() )
+  {
+    return r;
+  }
+
+  char tmp[1024];
+  std::string output;
+
+  while( true )
+  {
+    ssize_t bytes_read = read( fds[0], tmp, sizeof( tmp ) );
+    if( bytes_read <= 0 )
+    {
+      break;
+    }
+    output.append( tmp, bytes_read );
+  }
+
+  // remove trailing newline
+  if( !output.empty() && output.back() == '\n' )
+  {
+    output.pop_back();
+  }
+
+  close( fds[0] );
+  close( fds[1] );
+
+  return make_string( output );
+}
+
+static Expr * eval_pipe( Expr * args, Context * context, const IO & io )
+{
+  Expr * exec1 = args->car();
+  Expr * exec2 = args->cdr()->car();
+
+  int fds[2];
+  pipe( fds );
+  Expr * r;
+
+  {
+    Context * local = frames.push( context );
+    IO local_io;
+    local_io.pipe_stdin  = io.pipe_stdin;
+    local_io.pipe_stdout = fds[1];
+    ( void ) eval( exec1, *local, local_io );
+  }
+  {
+
+    Context * local = frames.push( context );
+    IO local_io;
+    local_io.pipe_stdin  = fds[0];
+    local_io.pipe_stdout = io.pipe_stdout;
+    r                    = eval( exec2, *local, local_io );
+  }
+
+  close( fds[0] );
+  close( fds[1] );
+  return r;
+}
+
+#endif
+
 Expr * eval( Expr * expr, Context & _context, const IO & io )
 {
+  check_stack();
   Context * context = &( _context );
+  FrameScope scope;
   while( true )
   {
+    count_step();
     switch( expr->type )
     {
-      case Expr::EXPR_ATOM :
-        {
-          return eval_atom( expr, *context, io );
-        }
       case Expr::EXPR_CONS :
         {
           Expr * op   = expr->car();
           Expr * args = expr->cdr();
 
-          if( op->is_symbol( KW_QUOTE ) )
+          switch( op->id )
           {
-            return args->car();
+            case SYM_QUOTE :
+              {
+                return args->car();
+              }
+            case SYM_UNQUOTE :
+              {
+                UNREACHABLE
+                return args->car();
+              }
+            case SYM_QUASIQUOTE :
+              {
+                Expr * a = args->car();
+                expr     = expand( a );
+                continue;
+              }
+            case SYM_DEFINE :
+              {
+                Expr * var   = args->car();
+                Expr * value = eval( args->cdr()->car(), *context, io );
+                context->defvar( var, value );
+                return make_void();
+              }
+            case SYM_LAMBDA :
+              {
+                Expr * params = args->car();
+                Expr * body   = args->cdr();
+                return make_lambda( params, body, context->promote() );
+              }
+            case SYM_IF :
+              {
+                Expr * cond      = eval( args->car(), *context, io );
+                Expr * then_expr = args->cdr()->car();
+                Expr * else_expr = args->cdr()->cdr()->car();
+                expr             = ( cond->is_truthy() ) ? then_expr : else_expr;
+                continue;
+              }
+            case SYM_PROGN :
+              {
+                for( Expr * it = args; it->is_cons(); it = it->cdr() )
+                {
+                  Expr * car = it->car();
+                  Expr * cdr = it->cdr();
+                  if( cdr->is_nil() )
+                  {
+                    expr = car;
+                  }
+                  else
+                  {
+                    ( void ) eval( car, *context, io );
+                  }
+                }
+                continue;
+              }
+            case SYM_LET :
+              {
+                Expr * bindings = args->car();
+                Expr * body     = args->cdr()->car();
+                Context * local = frames.push( context );
+                local->declare_bindings( bindings );
+                for( Expr * it = bindings; it->is_cons(); it = it->cdr() )
+                {
+                  Expr * binding = it->car();
+                  Expr * symbol  = binding->car();
+                  Expr * value   = binding->cdr()->car();
+                  value          = eval( value, *local, io );
+                  local->defvar( symbol, value );
+                }
+
+                context = local;
+                expr    = body;
+                continue;
+              }
+            case SYM_COND :
+              {
+                Expr * body = nullptr;
+                for( Expr * it = args; it->is_cons(); it = it->cdr() )
+                {
+                  Expr * cond   = it->car()->car();
+                  Expr * result = eval( cond, *context, io );
+                  if( result->is_truthy() )
+                  {
+                    body = it->car()->cdr();
+                    break;
+                  }
+                }
+
+                if( body == nullptr )
+                {
+                  return make_error( "cond expects at least one true condition" );
+                }
+                if( !body->is_cons() )
+                {
+                  return make_nil();
+                }
+
+                // the forms of the clause are evaluated in order, the last
+                // one in tail position
+                for( ; body->cdr()->is_cons(); body = body->cdr() )
+                {
+                  ( void ) eval( body->car(), *context, io );
+                }
+                expr = body->car();
+                continue;
+              }
+            case SYM_OR :
+              {
+                if( !args->is_cons() )
+                {
+                  return make_boolean( false );
+                }
+
+                // the last operand is in tail position
+                for( ; args->cdr()->is_cons(); args = args->cdr() )
+                {
+                  Expr * res = eval( args->car(), *context, io );
+                  if( res->is_truthy() )
+                    return res;
+                }
+                expr = args->car();
+                continue;
+              }
+            case SYM_AND :
+              {
+                if( !args->is_cons() )
+                {
+                  return make_boolean( true );
+                }
+
+                for( ; args->cdr()->is_cons(); args = args->cdr() )
+                {
+                  Expr * res = eval( args->car(), *context, io );
+                  if( !res->is_truthy() )
+                    return res;
+                }
+                expr = args->car();
+                continue;
+              }
+            case SYM_WHILE :
+              {
+                while( eval( args->car(), *context, io )->is_truthy() )
+                {
+                  eval_body( args->cdr(), *context, io );
+                }
+                return make_nil();
+              }
+            case SYM_DOTIMES :
+              {
+                Expr * head = args->car();
+                if( !is_loop_head( head ) )
+                {
+                  return make_error( "dotimes expects a variable and a count" );
+                }
+
+                // one frame holds the variable for all iterations
+                Context * local = frames.push( context );
+                local->declare( head->car() );
+                Expr * count = eval( head->cdr()->car(), *local, io );
+                if( !count->is_integer() )
+                {
+                  return make_error( "dotimes expects an integer count" );
+                }
+
+                for( std::int64_t i = 0; i < count->integer; i++ )
+                {
+                  local->defvar( head->car(), make_integer( i ) );
+                  eval_body( args->cdr(), *local, io );
+                }
+                return make_nil();
+              }
+            case SYM_DOLIST :
+              {
+                Expr * head = args->car();
+                if( !is_loop_head( head ) )
+                {
+                  return make_error( "dolist expects a variable and a list" );
+                }
+
+                Context * local = frames.push( context );
+                local->declare( head->car() );
+                Expr * list = eval( head->cdr()->car(), *local, io );
+                for( ; list->is_cons(); list = list->cdr() )
+                {
+                  local->defvar( head->car(), list->car() );
+                  eval_body( args->cdr(), *local, io );
+                }
+                return make_nil();
+              }
+            case SYM_MACRO :
+              {
+                Expr * params = args->car();
+                Expr * body   = args->cdr();
+                return make_macro( params, body, context->promote() );
+              }
+#ifdef __linux__
+            case SYM_TO_STREAM :
+              {
+                return eval_to_stream( args, context, io );
+              }
+            case SYM_FROM_STREAM :
+              {
+                return eval_from_stream( args, context, io );
+              }
+            case SYM_PIPE :
+              {
+                return eval_pipe( args, context, io );
+              }
+#endif
+            default :
+              {
+                Expr * fn = eval( op, *context, io );
+                if( fn->is_macro() )
+                {
+                  // Context * new_env = gc::alloc<Context>( fn->macro->env );
+                  Context * new_env = frames.push( context );
+                  bind_params( new_env, fn->macro->params, args );
+
+                  expr    = fn->macro->body->car();
+                  context = new_env;
+
+                  expr = eval( expr, *context, io );
+                  continue;
+                }
+                else
+                {
+                  std::size_t argc = 0;
+                  for( Expr * it = args; it->is_cons(); it = it->cdr() )
+                  {
+                    argc++;
+                  }
+
+                  Expr ** values = arguments.push( argc );
+                  for( std::size_t i = 0; i < argc; i++, args = args->cdr() )
+                  {
+                    values[i] = eval( args->car(), *context, io );
+                  }
+
+                  if( fn->is_native() )
+                  {
+                    Expr * result = call_native( fn, Args{ values, argc }, *context, io );
+                    arguments.pop( values );
+                    return result;
+                  }
+                  else if( fn->is_lambda() )
+                  {
+                    // the frames of this activation are dead once the call
+                    // replaces them
+                    frames.pop( scope.height );
+
+                    Context * new_env;
+                    if( fn->lambda->escapes )
+                    {
+                      new_env = gc::alloc<Context>( fn->lambda->env );
+                    }
+                    else
+                    {
+                      new_env = frames.push( fn->lambda->env );
+                    }
+                    bind_params( new_env, fn->lambda->params, values, argc );
+                    arguments.pop( values );
+
+                    if( current_engine == ENGINE_CLOSURE )
+                    {
+                      return exec( lambda_code( fn ), *new_env, io );
+                    }
+                    else if( current_engine == ENGINE_VM )
+                    {
+                      return vm::run( vm::lambda_chunk( fn ), *new_env, io );
+                    }
+
+                    expr    = fn->lambda->body->car();
+                    context = new_env;
+                    continue;
+                  }
+                  else
+                  {
+                    arguments.pop( values );
+                    return fn;
+                  }
+                }
+              }
           }
-          else if( op->is_symbol( KW_UNQUOTE ) )
+        }
+      case Expr::EXPR_VOID :
+        return make_void();
+      default :
+        return eval_atom( expr, *context, io );
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+Expr * exec( Node * node, Context & _context, const IO & io )
+{
+  check_stack();
+  Context * context = &( _context );
+  FrameScope scope;
+  while( true )
+  {
+    count_step();
+    switch( node->kind )
+    {
+      case Node::NODE_CONST :
+        return node->expr;
+      case Node::NODE_REF :
+        return context->lookup( node->expr );
+      case Node::NODE_LOCAL :
+        return context->lookup( node->depth, node->slot, node->expr );
+      case Node::NODE_GLOBAL :
+        return context->lookup( node->expr, node->cache );
+      case Node::NODE_DEFINE :
+        {
+          Expr * value = exec( node->nodes[0], *context, io );
+          context->defvar( node->expr, value );
+          return make_void();
+        }
+      case Node::NODE_LAMBDA :
+        {
+          Expr * fn = make_lambda( node->expr->car(), node->expr->cdr(), context->promote() );
+          if( !node->nodes.empty() )
           {
-            UNREACHABLE
-            return args->car();
+            fn->lambda->code = node->nodes[0];
+            gc::write_barrier( fn, fn->lambda->code );
           }
-          else if( op->is_symbol( KW_QUASIQUOTE ) )
+          return fn;
+        }
+      case Node::NODE_MACRO :
+        return make_macro( node->expr->car(), node->expr->cdr(), context->promote() );
+      case Node::NODE_IF :
+        {
+          Expr * cond = exec( node->nodes[0], *context, io );
+          node        = node->nodes[cond->is_truthy() ? 1 : 2];
+          continue;
+        }
+      case Node::NODE_PROGN :
+        {
+          std::size_t last = node->nodes.size() - 1;
+          for( std::size_t i = 0; i < last; i++ )
           {
-            Expr * a = args->car();
-            expr     = expand( a );
-            continue;
+            ( void ) exec( node->nodes[i], *context, io );
           }
-          else if( op->is_symbol( KW_DEFINE ) )
+          node = node->nodes[last];
+          continue;
+        }
+      case Node::NODE_LET :
+        {
+          Context * local = frames.push( context );
+          local->declare_bindings( node->expr );
+
+          std::size_t i = 0;
+          for( Expr * it = node->expr; it->is_cons(); it = it->cdr(), i++ )
           {
-            Expr * var   = args->car();
-            Expr * value = eval( args->cdr()->car(), *context, io );
-            context->defvar( var->atom.symbol, value );
-            return make_void();
+            Expr * value = exec( node->nodes[i], *local, io );
+            local->defvar( it->car()->car(), value );
           }
-          else if( op->is_symbol( KW_LAMBDA ) )
+
+          context = local;
+          node    = node->nodes[i];
+          continue;
+        }
+      case Node::NODE_COND :
+        {
+          Node * body = nullptr;
+          for( std::size_t i = 0; i < node->nodes.size(); i += 2 )
           {
-            Expr * params = args->car();
-            Expr * body   = args->cdr();
-            return make_lambda( params, body, context );
+            Expr * result = exec( node->nodes[i], *context, io );
+            if( result->is_truthy() )
+            {
+              body = node->nodes[i + 1];
+              break;
+            }
           }
-          else if( op->is_symbol( KW_IF ) )
+
+          if( body == nullptr )
           {
-            Expr * cond      = eval( args->car(), *context, io );
-            Expr * then_expr = args->cdr()->car();
-            Expr * else_expr = args->cdr()->cdr()->car();
-            expr             = ( cond->is_truthy() ) ? then_expr : else_expr;
-            continue;
+            return make_error( "cond expects at least one true condition" );
           }
-          else if( op->is_symbol( KW_PROGN ) )
+
+          node = body;
+          continue;
+        }
+      case Node::NODE_OR :
+        {
+          if( node->nodes.empty() )
           {
-            for( Expr * it = args; it->is_cons(); it = it->cdr() )
-            {
-              Expr * car = it->car();
-              Expr * cdr = it->cdr();
-              if( cdr->is_nil() )
-              {
-                expr = car;
-              }
-              else
-              {
-                ( void ) eval( car, *context, io );
-              }
-            }
-            continue;
+            return make_boolean( false );
           }
-          else if( op->is_symbol( KW_LET ) )
-          {
-            Expr * bindings = args->car();
-            Expr * body     = args->cdr()->car();
-            Context * local = gc::alloc<Context>( context );
-            for( Expr * it = bindings; it->is_cons(); it = it->cdr() )
-            {
-              Expr * binding = it->car();
-              Expr * symbol  = binding->car();
-              Expr * value   = binding->cdr()->car();
-              value          = eval( value, *local, io );
-              local->defvar( symbol->as_symbol(), value );
-            }
 
-            context = local;
-            expr    = body;
-            continue;
+          // the last operand is in tail position
+          std::size_t last = node->nodes.size() - 1;
+          for( std::size_t i = 0; i < last; i++ )
+          {
+            Expr * result = exec( node->nodes[i], *context, io );
+            if( result->is_truthy() )
+              return result;
           }
-          else if( op->is_symbol( KW_COND ) )
+          node = node->nodes[last];
+          continue;
+        }
+      case Node::NODE_AND :
+        {
+          if( node->nodes.empty() )
           {
-            Expr * body = nullptr;
-            for( Expr * it = args; it->is_cons(); it = it->cdr() )
-            {
-              Expr * cond   = it->car()->car();
-              Expr * result = eval( cond, *context, io );
-              if( result->is_truthy() )
-              {
-                body = it->car()->cdr();
-                break;
-              }
-            }
-
-            if( body == nullptr )
-            {
-              body = make_error( "cond expects at least one true condition" );
-            }
+            return make_boolean( true );
+          }
 
-            expr = body;
-            continue;
+          std::size_t last = node->nodes.size() - 1;
+          for( std::size_t i = 0; i < last; i++ )
+          {
+            Expr * result = exec( node->nodes[i], *context, io );
+            if( !result->is_truthy() )
+              return result;
           }
-          else if( op->is_symbol( KW_OR ) )
+          node = node->nodes[last];
+          continue;
+        }
+      case Node::NODE_WHILE :
+        {
+          while( exec( node->nodes[0], *context, io )->is_truthy() )
           {
-            for( Expr * it = args; it->is_cons(); it = it->cdr() )
-            {
-              Expr * res = eval( it->car(), *context, io );
-              if( res->is_truthy() )
-                return make_boolean( true );
-            }
-            return make_boolean( false );
+            ( void ) exec( node->nodes[1], *context, io );
           }
-          else if( op->is_symbol( KW_AND ) )
+          return make_nil();
+        }
+      case Node::NODE_DOTIMES :
+        {
+          Expr * var      = node->expr->car();
+          Context * local = frames.push( context );
+          local->declare( var );
+          Expr * count = exec( node->nodes[0], *local, io );
+          if( !count->is_integer() )
           {
-            for( Expr * it = args; it->is_cons(); it = it->cdr() )
-            {
-              Expr * res = eval( it->car(), *context, io );
-              if( !res->is_truthy() )
-                return make_boolean( false );
-            }
-            return make_boolean( true );
+            return make_error( "dotimes expects an integer count" );
           }
-          else if( op->is_symbol( KW_MACRO ) )
+
+          for( std::int64_t i = 0; i < count->integer; i++ )
           {
-            Expr * params = args->car();
-            Expr * body   = args->cdr();
-            return make_macro( params, body, context );
+            local->defvar( var, make_integer( i ) );
+            ( void ) exec( node->nodes[1], *local, io );
           }
-#ifdef __linux__
-          else if( op->is_symbol( KW_TO_STREAM ) )
+          return make_nil();
+        }
+      case Node::NODE_DOLIST :
+        {
+          Expr * var      = node->expr->car();
+          Context * local = frames.push( context );
+          local->declare( var );
+          Expr * list = exec( node->nodes[0], *local, io );
+          for( ; list->is_cons(); list = list->cdr() )
           {
-            Expr * r         = eval( args, *context, io );
-            std::string data = to_string( r );
-
-            ssize_t n;
-            ssize_t total = 0;
-
-            while( total < ( ssize_t ) data.size() )
-            {
-              n = write( io.pipe_stdout, data.data() + total, data.size() - total );
-              if( n < 0 )
-              {
-                break;
-              }
-              total += n;
-            }
-
-            if( io.pipe_stdout != STDOUT_FILENO )
-            {
-              close( io.pipe_stdout );
-            }
+            local->defvar( var, list->car() );
+            ( void ) exec( node->nodes[1], *local, io );
           }
-          else if( op->is_symbol( KW_FROM_STREAM ) )
+          return make_nil();
+        }
+      case Node::NODE_CALL :
+        {
+          Expr * fn = exec( node->nodes[0], *context, io );
+          if( fn->is_macro() )
           {
-            int fds[2];
-            pipe( fds );
-
-            IO local_io;
-            local_io.pipe_stdin  = io.pipe_stdin;
-            local_io.pipe_stdout = fds[1];
-
-            Expr * r = eval( args, *context, local_io );
-            if( r->is_error() )
-            {
-              return r;
-            }
-
-            char tmp[1024];
-            ssize_t total = 0;
-            char * buffer = nullptr;
-
-            while( true )
-            {
-              ssize_t bytes_read = read( fds[0], tmp, sizeof( tmp ) );
-              if( bytes_read <= 0 )
-              {
-                break;
-              }
-
-              buffer = ( char * ) realloc( buffer, total + bytes_read + 1 );
-              memcpy( buffer + total, tmp, bytes_read );
-              total += bytes_read;
-            }
+            Context * new_env = frames.push( context );
+            bind_params( new_env, fn->macro->params, node->expr->cdr() );
 
-            if( total > 0 )
+            // a call site is expanded once, unless its operator changes
+            if( node->macro != fn )
             {
-              buffer[total] = '\0';
-              // remove trailing newline
-              if( buffer[total - 1] == '\n' )
-              {
-                buffer[total - 1] = '\0';
-              }
+              Expr * expansion = exec( macro_code( fn ), *new_env, io );
+              node->expansion  = analyze( expansion );
+              node->macro      = fn;
+              gc::write_barrier( node, node->expansion );
+              gc::write_barrier( node, fn );
             }
+            context = new_env;
+            node    = node->expansion;
+            continue;
+          }
 
-            close( fds[0] );
-            close( fds[1] );
+          std::size_t argc = node->nodes.size() - 1;
+          Expr ** values   = arguments.push( argc );
+          for( std::size_t i = 0; i < argc; i++ )
+          {
+            values[i] = exec( node->nodes[i + 1], *context, io );
+          }
 
-            return make_string_take_ownership( buffer );
+          if( fn->is_native() )
+          {
+            Expr * result = call_native( fn, Args{ values, argc }, *context, io );
+            arguments.pop( values );
+            return result;
           }
-          else if( op->is_symbol( KW_PIPE ) )
+          else if( fn->is_lambda() )
           {
-            Expr * exec1 = args->car();
-            Expr * exec2 = args->cdr()->car();
-
-            int fds[2];
-            pipe( fds );
-            Expr * r;
+            frames.pop( scope.height );
 
+            Context * new_env;
+            if( fn->lambda->escapes )
             {
-              Context * local = gc::alloc<Context>( context );
-              IO local_io;
-              local_io.pipe_stdin  = io.pipe_stdin;
-              local_io.pipe_stdout = fds[1];
-              ( void ) eval( exec1, *local, local_io );
+              new_env = gc::alloc<Context>( fn->lambda->env );
             }
+            else
             {
-
-              Context * local = gc::alloc<Context>( context );
-              IO local_io;
-              local_io.pipe_stdin  = fds[0];
-              local_io.pipe_stdout = io.pipe_stdout;
-              r                    = eval( exec2, *local, local_io );
+              new_env = frames.push( fn->lambda->env );
             }
+            bind_params( new_env, fn->lambda->params, values, argc );
+            arguments.pop( values );
 
-            close( fds[0] );
-            close( fds[1] );
-            return r;
+            context = new_env;
+            node    = lambda_code( fn );
+            continue;
           }
-#endif
           else
           {
-            Expr * fn = eval( op, *context, io );
-            if( fn->is_macro() )
-            {
-              // Context * new_env = gc::alloc<Context>( fn->atom.macro.env );
-              Context * new_env = gc::alloc<Context>( context );
-              bind_params( new_env, fn->atom.macro.params, args );
-
-              expr    = fn->atom.macro.body->car();
-              context = new_env;
-
-              expr = eval( expr, *context, io );
-              continue;
-            }
-            else
-            {
-              args = eval_list( args, *context, io );
-
-              if( fn->is_native() )
-              {
-                return fn->atom.native( args, *context, io );
-              }
-              else if( fn->is_lambda() && !args->is_nil() )
-              {
-                Context * new_env = gc::alloc<Context>( fn->atom.lambda.env );
-                bind_params( new_env, fn->atom.lambda.params, args );
-
-                expr    = fn->atom.lambda.body->car();
-                context = new_env;
-                continue;
-              }
-              else
-              {
-                return fn;
-              }
-            }
+            arguments.pop( values );
+            return fn;
           }
         }
-      default :
-        return make_void();
+      case Node::NODE_CONS :
+        {
+          Expr * car = exec( node->nodes[0], *context, io );
+          Expr * cdr = exec( node->nodes[1], *context, io );
+          return make_cons( car, cdr );
+        }
+      case Node::NODE_SPLICE :
+        {
+          Expr * list = exec( node->nodes[0], *context, io );
+          Expr * rest = exec( node->nodes[1], *context, io );
+          return splice( list, rest );
+        }
+      case Node::NODE_FALLBACK :
+        return eval( node->expr, *context, io );
     }
   }
 }
@@ -610,6 +1845,15 @@ int eval( const std::string & source, Context & context, const IO & io, Flags fl
   if( !program )
     return 2;
 
+  if( flags & FLAG_DUMP_OPTIMIZED )
+  {
+    for( Expr * it = program; it->is_cons(); it = it->cdr() )
+    {
+      io.out << to_string_repr( optimize( it->car(), context, io ) ) << std::endl;
+    }
+    return 0;
+  }
+
   Expr * res = eval_program( program, context, io );
   if( !res )
     return 3;
@@ -766,7 +2010,7 @@ int repl()
       continue;
 
     Expr * form   = parse( line );
-    Expr * result = eval( form, ctx, io );
+    Expr * result = eval_program( form, ctx, io );
 
     if( !result->is_error() )
       ctx.defvar( "_", result );
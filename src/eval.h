@@ -6,9 +6,10 @@
 #include "version.h"
 
 #include <cstdint>
+#include <functional>
 #include <iostream>
-#include <map>
 #include <ostream>
+#include <unordered_map>
 #include <vector>
 
 namespace lisp
@@ -18,17 +19,82 @@ namespace lisp
 
 using Flags = uint8_t;
 
-constexpr Flags FLAG_NONE        = 0;
-constexpr Flags FLAG_NEWLINE     = 1 << 0;
-constexpr Flags FLAG_DUMP_TOKENS = 1 << 1;
-constexpr Flags FLAG_DUMP_AST    = 1 << 2;
-constexpr Flags FLAG_DUMP_ENV    = 1 << 3;
-constexpr Flags FLAG_INTERACTIVE = 1 << 4;
-constexpr Flags FLAG_INIT        = 1 << 5;
+constexpr Flags FLAG_NONE           = 0;
+constexpr Flags FLAG_NEWLINE        = 1 << 0;
+constexpr Flags FLAG_DUMP_TOKENS    = 1 << 1;
+constexpr Flags FLAG_DUMP_AST       = 1 << 2;
+constexpr Flags FLAG_DUMP_ENV       = 1 << 3;
+constexpr Flags FLAG_INTERACTIVE    = 1 << 4;
+constexpr Flags FLAG_INIT           = 1 << 5;
+constexpr Flags FLAG_DUMP_OPTIMIZED = 1 << 6; // print the optimized forms, do not evaluate them
 
 ///////////////////////////////////////////////////////////////////////////////
 
-using Env = std::map<std::string, Expr *>;
+enum Engine
+{
+  // evaluate the parsed forms directly
+  ENGINE_TREE,
+  // analyze every form once and execute the resulting nodes
+  ENGINE_CLOSURE,
+  // compile every form to bytecode and run it on the virtual machine
+  ENGINE_VM,
+};
+
+void set_engine( Engine );
+
+Engine engine();
+
+///////////////////////////////////////////////////////////////////////////////
+
+// the memory eval_program() may use for recursion, deeper programs fail with
+// a stack-overflow error
+constexpr std::size_t DEFAULT_STACK_BUDGET = std::size_t( 256 ) << 20;
+
+void set_stack_budget( std::size_t bytes );
+
+std::size_t stack_budget();
+
+// abandons the running evaluation, the outermost eval_program() returns an
+// error with 'message' instead
+[[noreturn]] void abandon( const char * message );
+
+// abandons the evaluation once it has used up the stack budget
+void check_stack();
+
+// the steps left until the budget of the running program is checked again
+extern std::uint64_t budget_ticks;
+
+// abandons the evaluation once it has used up the budget of its IO
+void check_budget();
+
+// counts one evaluation step, a call or an iteration of a loop
+inline void count_step()
+{
+  if( --budget_ticks == 0 )
+  {
+    check_budget();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// the slots of the global bindings, keyed by the interned symbol
+using Env = std::unordered_map<const Expr *, std::uint32_t>;
+
+class Context;
+
+// the root slot a global reference was found in. it is only valid while
+// 'version' matches the version of the globals.
+struct GlobalCache
+{
+  std::uint32_t version = 0;
+  std::uint32_t slot    = 0;
+  const Context * root  = nullptr;
+};
+
+// true once a frame bound 'symbol' without declaring it. references to such
+// names are no globals, they are looked up by name.
+bool is_frame_bound( const Expr * symbol );
 
 class Context : public gc::Garbage
 {
@@ -36,32 +102,102 @@ public:
   Context( Context * parent = nullptr );
   ~Context();
   Expr * lookup( const char * symbol ) const;
+  Expr * lookup( Expr * symbol ) const;
   void defvar( const char * symbol, Expr * expr );
+  void defvar( Expr * symbol, Expr * expr );
   void print( const IO & io ) const;
-  const Env & env() const;
-  void mark() override;
+  void mark();
   Context * parent()
   {
     return m_parent;
   }
 
+  // a variable that was resolved to the slot 'slot' of the frame 'depth'
+  // levels up. frames that gained bindings after they were created and slots
+  // that do not hold 'symbol' fall back to looking it up by name.
+  Expr * lookup( std::uint32_t depth, std::uint32_t slot, Expr * symbol ) const;
+
+  // a variable that no frame declares or binds, the context is a frame of
+  // the root or the root itself. the root slot is remembered in 'cache'.
+  Expr * lookup( Expr * symbol, GlobalCache & cache ) const;
+
+  // adds an unbound slot to a new frame, slots are numbered in the order
+  // their names are declared, repeated names share the first slot
+  void declare( Expr * symbol );
+
+  // declares the names bound by a lambda or macro parameter list
+  void declare_params( Expr * params );
+
+  // declares the names bound by a let
+  void declare_bindings( Expr * bindings );
+
+  // frames on the frame stack are moved to the heap when a closure captures
+  // them, afterwards the frame forwards to its heap copy
+  Context * promote();
+  bool is_frame() const;
+  bool is_root() const;
+
   bool exit;
   int exit_code;
 
 private:
+  friend class Frames;
+
+  struct Slot
+  {
+    Expr * symbol;
+    Expr * value; // nullptr while unbound
+  };
+
   Context * m_parent;
-  Env m_env;
-  bool is_root() const;
+  Context * m_promoted;
+  bool m_frame;
+  bool m_dynamic; // a name was defined that was not declared
+  Env m_env;      // the slots of the root by symbol
+  SmallVector<Slot, 4> m_slots;
 };
 
+// true for the '&rest' marker in a parameter list
+bool is_rest_param( Expr * param );
+
 ///////////////////////////////////////////////////////////////////////////////
 
 void print_version_info();
 
 Expr * expand( Expr * expr );
 
+// appends 'rest' to the end of 'list', which is modified
+Expr * splice( Expr * list, Expr * rest );
+
 Expr * eval( Expr * expr, Context & context, const IO & io );
 
+Expr * exec( Node * node, Context & context, const IO & io );
+
+void bind_params( Context * local, Expr * params, Expr * args );
+
+void bind_params( Context * local, Expr * params, Expr ** args, std::size_t argc );
+
+// checks the arity of the native 'fn' and calls it
+Expr * call_native( Expr * fn, Args args, Context & context, const IO & io );
+
+// the error of a native whose argument 'index' is not of the expected type
+Expr * type_error( const char * name, std::size_t index, const char * expected, Expr * arg );
+
+// the argument stack, natives receive a span of it
+Expr ** push_arguments( std::size_t n );
+
+void pop_arguments( Expr ** span );
+
+// expands 'form' for as long as it is a call to a macro
+Expr * macroexpand( Expr * form, Context & context, const IO & io );
+
+// the frame stack, for engines that keep track of their own activations
+Context * push_frame( Context * parent );
+
+void pop_frames( std::size_t height );
+
+std::size_t frame_height();
+
 int eval( const std::string & source, Context & context, const IO & io, Flags flags = FLAG_INTERACTIVE );
 
 int eval( const std::string & source, Flags flags = FLAG_NEWLINE | FLAG_INTERACTIVE );
@@ -1,45 +1,170 @@
 #include "expr.h"
+#include "analyze.h"
 #include "eval.h"
 #include "tokenizer.h"
 #include "util.h"
+#include "vm.h"
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 
 namespace lisp
 {
 
 ///////////////////////////////////////////////////////////////////////////////
 
+static_assert( sizeof( Expr ) <= 24, "Expr should fit into three words" );
+
+Expr NIL_EXPR( Expr::EXPR_NIL );
+Expr VOID_EXPR( Expr::EXPR_VOID );
+Expr TRUE_EXPR( Expr::EXPR_BOOLEAN );
+Expr FALSE_EXPR( Expr::EXPR_BOOLEAN );
+Expr SMALL_INTEGERS[SMALL_INTEGER_MAX - SMALL_INTEGER_MIN + 1];
+
+static bool init_static_exprs()
+{
+  TRUE_EXPR.boolean  = true;
+  FALSE_EXPR.boolean = false;
+  gc::add_static( &NIL_EXPR );
+  gc::add_static( &VOID_EXPR );
+  gc::add_static( &TRUE_EXPR );
+  gc::add_static( &FALSE_EXPR );
+
+  for( int i = SMALL_INTEGER_MIN; i <= SMALL_INTEGER_MAX; i++ )
+  {
+    Expr & expr  = SMALL_INTEGERS[i - SMALL_INTEGER_MIN];
+    expr.type    = Expr::EXPR_INTEGER;
+    expr.integer = i;
+    gc::add_static( &expr );
+  }
+  return true;
+}
+
+static bool static_exprs = init_static_exprs();
+
+///////////////////////////////////////////////////////////////////////////////
+
+String * String::make( const char * data, std::size_t length )
+{
+  String * string  = static_cast<String *>( malloc( sizeof( String ) + length ) );
+  string->m_refs   = 1;
+  string->m_length = length;
+  memcpy( string->m_data, data, length );
+  string->m_data[length] = '\0';
+  return string;
+}
+
+void String::release()
+{
+  if( --m_refs == 0 )
+  {
+    free( this );
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+class SymbolTable
+{
+public:
+  SymbolTable()
+  {
+    // in the order of SymbolId, so that the keywords get their fixed ids
+    const char * keywords[] = { KW_QUOTE,     KW_UNQUOTE,     KW_UNQUOTE_SPLICE, KW_QUASIQUOTE, KW_DEFINE, KW_LAMBDA,
+                                KW_IF,        KW_PROGN,       KW_LET,            KW_COND,       KW_OR,     KW_AND,
+                                KW_MACRO,     KW_TO_STREAM,   KW_FROM_STREAM,    KW_PIPE,       KW_CONS,   KW_APPEND,
+                                KW_WHILE,     KW_DOTIMES,     KW_DOLIST };
+
+    for( const char * keyword : keywords )
+    {
+      intern( keyword );
+    }
+    assert( m_next_id == SYM_KEYWORD_COUNT );
+  }
+
+  Expr * intern( const char * name )
+  {
+    auto it = m_symbols.find( name );
+    if( it != m_symbols.end() )
+    {
+      return it->second;
+    }
+
+    Expr * expr  = new Expr( Expr::EXPR_SYMBOL );
+    expr->symbol = STRDUP( name );
+    expr->id     = m_next_id++;
+    gc::add_static( expr );
+    m_symbols.emplace( expr->symbol, expr );
+    return expr;
+  }
+
+private:
+  std::unordered_map<std::string_view, Expr *> m_symbols;
+  std::uint32_t m_next_id = SYM_NONE + 1;
+};
+
+Expr * make_symbol( const char * symbol )
+{
+  // never destroyed, symbols may be used until the very end
+  static SymbolTable * table = new SymbolTable();
+  return table->intern( symbol );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool may_capture( Expr * body )
+{
+  for( ; body->is_cons(); body = body->cdr() )
+  {
+    if( may_capture( body->car() ) )
+    {
+      return true;
+    }
+  }
+  return body->is_symbol( SYM_LAMBDA ) || body->is_symbol( SYM_MACRO );
+}
+
 Expr::~Expr()
 {
   switch( type )
   {
-    case EXPR_ATOM :
-      atom.~Atom();
+    case EXPR_SYMBOL :
+      free( symbol );
+      break;
+    case EXPR_STRING :
+      string->release();
+      break;
+    case EXPR_ERROR :
+      free( error );
+      break;
+    case EXPR_LAMBDA :
+      delete lambda;
+      break;
+    case EXPR_MACRO :
+      delete macro;
+      break;
+    case EXPR_BIGNUM :
+      delete bignum;
       break;
-    case EXPR_CONS :
-    case EXPR_VOID :
+    default :
       // do nothing
       break;
   }
 }
 
-Expr::Expr()
+Expr::Expr( Type t )
     : gc::Garbage()
-    , type( EXPR_VOID )
-{
-}
-
-Expr::Expr( Atom && a )
-    : gc::Garbage()
-    , type( EXPR_ATOM )
-    , atom( std::move( a ) )
+    , type( t )
+    , id( SYM_NONE )
+    , cons( nullptr, nullptr )
 {
 }
 
 Expr::Expr( Cons c )
     : gc::Garbage()
     , type( EXPR_CONS )
+    , id( SYM_NONE )
     , cons( c )
 {
 }
@@ -56,32 +181,37 @@ bool Expr::is_cons() const
 
 bool Expr::is_atom() const
 {
-  return type == Expr::EXPR_ATOM;
+  return type != Expr::EXPR_CONS && type != Expr::EXPR_VOID;
 }
 
-bool Expr::is_atom( Atom::Type atype ) const
+bool Expr::is_type( Type t ) const
 {
-  return is_atom() && ( atom.type == atype );
+  return type == t;
 }
 
-bool Expr::is_symbol( const char * symbol ) const
+bool Expr::is_symbol( const char * sym ) const
 {
-  return is_atom() && ( atom.type == Atom::ATOM_SYMBOL ) && ( strcmp( atom.symbol, symbol ) == 0 );
+  return ( type == Expr::EXPR_SYMBOL ) && ( strcmp( symbol, sym ) == 0 );
+}
+
+bool Expr::is_symbol( SymbolId symbol_id ) const
+{
+  return id == symbol_id;
 }
 
 bool Expr::is_native() const
 {
-  return is_atom() && ( atom.type == Atom::ATOM_NATIVE );
+  return type == Expr::EXPR_NATIVE;
 }
 
 bool Expr::is_lambda() const
 {
-  return is_atom() && ( atom.type == Atom::ATOM_LAMBDA );
+  return type == Expr::EXPR_LAMBDA;
 }
 
 bool Expr::is_macro() const
 {
-  return is_atom() && ( atom.type == Atom::ATOM_MACRO );
+  return type == Expr::EXPR_MACRO;
 }
 
 bool Expr::is_procedure() const
@@ -91,45 +221,63 @@ bool Expr::is_procedure() const
 
 bool Expr::is_error() const
 {
-  return is_atom() && ( atom.type == Atom::ATOM_ERROR );
+  return type == Expr::EXPR_ERROR;
 }
 
 bool Expr::is_truthy() const
 {
-  if( is_cons() )
-  {
-    return true;
-  }
-  else if( is_atom() )
-  {
-    return atom.is_truthy();
-  }
-  else
+  switch( type )
   {
-    return false;
+    case Expr::EXPR_CONS :
+      return true;
+    case Expr::EXPR_BOOLEAN :
+      return boolean;
+    case Expr::EXPR_REAL :
+      return real != 0;
+    case Expr::EXPR_INTEGER :
+      return integer != 0;
+    case Expr::EXPR_BIGNUM :
+      return true;
+    case Expr::EXPR_STRING :
+      return string->length() != 0;
+    case Expr::EXPR_VOID :
+    case Expr::EXPR_NIL :
+    case Expr::EXPR_ERROR :
+    case Expr::EXPR_SYMBOL :
+    case Expr::EXPR_LAMBDA :
+    case Expr::EXPR_NATIVE :
+    case Expr::EXPR_MACRO :
+      return false;
   }
+
+  UNREACHABLE
+  return false;
 }
 
 void Expr::mark()
 {
-  set_marked( true );
-  if( is_cons() )
-  {
-    cons.car->mark();
-    cons.cdr->mark();
-  }
-  else if( is_atom() )
+  switch( type )
   {
-    // closures?
-    if( is_lambda() )
-    {
-#if 0
-         for( auto & [k, v] : atom.lambda.closure->env() )
-         {
-            v->mark();
-         }
-#endif
-    }
+    case Expr::EXPR_CONS :
+      gc::mark( cons.car );
+      gc::mark( cons.cdr );
+      break;
+    case Expr::EXPR_LAMBDA :
+      gc::mark( lambda->params );
+      gc::mark( lambda->body );
+      gc::mark( lambda->env );
+      gc::mark( lambda->code );
+      gc::mark( lambda->chunk );
+      break;
+    case Expr::EXPR_MACRO :
+      gc::mark( macro->params );
+      gc::mark( macro->body );
+      gc::mark( macro->env );
+      gc::mark( macro->code );
+      gc::mark( macro->chunk );
+      break;
+    default :
+      break;
   }
 }
 
@@ -165,7 +313,7 @@ const char * Expr::as_symbol() const
 {
   if( is_symbol() )
   {
-    return atom.symbol;
+    return symbol;
   }
   else
   {
@@ -178,7 +326,7 @@ const char * Expr::as_string() const
 {
   if( is_string() )
   {
-    return atom.string;
+    return string->data();
   }
   else
   {
@@ -187,11 +335,11 @@ const char * Expr::as_string() const
   }
 }
 
-int Expr::as_integer() const
+std::int64_t Expr::as_integer() const
 {
   if( is_integer() )
   {
-    return atom.integer;
+    return integer;
   }
   else
   {
@@ -204,7 +352,7 @@ double Expr::as_real() const
 {
   if( is_real() )
   {
-    return atom.real;
+    return real;
   }
   else
   {
@@ -217,11 +365,15 @@ double Expr::as_number() const
 {
   if( is_integer() )
   {
-    return ( double ) atom.integer;
+    return ( double ) integer;
   }
   else if( is_real() )
   {
-    return atom.real;
+    return real;
+  }
+  else if( is_bignum() )
+  {
+    return bignum->to_double();
   }
   else
   {
@@ -234,218 +386,72 @@ Expr * cast_to_string( Expr * expr )
 {
   if( expr->is_string() )
   {
-    return make_string( expr->atom.string );
+    // strings are immutable, so the cell can be shared
+    return expr;
   }
   else
   {
-    std::string str = to_string( expr );
-    return make_string( str.c_str() );
+    return make_string( to_string( expr ) );
   }
 }
 
 bool Expr::is_nil() const
 {
-  return ( is_atom() ) && ( atom.type == Atom::ATOM_NIL );
+  return type == Expr::EXPR_NIL;
 }
 
 bool Expr::is_string() const
 {
-  return is_atom() && ( atom.type == Atom::ATOM_STRING );
+  return type == Expr::EXPR_STRING;
 }
 
 bool Expr::is_real() const
 {
-  return is_atom() && ( atom.type == Atom::ATOM_REAL );
+  return type == Expr::EXPR_REAL;
 }
 
 bool Expr::is_integer() const
 {
-  return is_atom() && ( atom.type == Atom::ATOM_INTEGER );
+  return type == Expr::EXPR_INTEGER;
 }
 
-bool Expr::is_number() const
+bool Expr::is_bignum() const
 {
-  return is_real() || is_integer();
+  return type == Expr::EXPR_BIGNUM;
 }
 
-bool Expr::is_symbol() const
-{
-  return is_atom() && ( atom.type == Atom::ATOM_SYMBOL );
-}
-
-///////////////////////////////////////////////////////////////////////////////
-
-Atom::Atom()
-    : type( ATOM_NIL )
-{
-}
-
-Atom::~Atom()
-{
-  switch( type )
-  {
-    case lisp::Atom::ATOM_NIL :
-    case lisp::Atom::ATOM_REAL :
-    case lisp::Atom::ATOM_INTEGER :
-    case lisp::Atom::ATOM_BOOLEAN :
-    case lisp::Atom::ATOM_LAMBDA :
-    case lisp::Atom::ATOM_NATIVE :
-    case lisp::Atom::ATOM_MACRO :
-      break;
-    case lisp::Atom::ATOM_SYMBOL :
-      if( symbol )
-      {
-        free( symbol );
-      }
-      break;
-    case lisp::Atom::ATOM_STRING :
-      if( string )
-      {
-        free( string );
-      }
-      break;
-    case lisp::Atom::ATOM_ERROR :
-      if( error )
-      {
-        free( error );
-      }
-      break;
-  }
-}
-
-Atom::Atom( Atom && other ) noexcept
-    : type( other.type )
+bool Expr::is_number() const
 {
-  switch( type )
-  {
-    case lisp::Atom::ATOM_NIL :
-      break;
-    case lisp ::Atom ::ATOM_BOOLEAN :
-      boolean = other.boolean;
-      break;
-    case lisp::Atom::ATOM_REAL :
-      real = other.real;
-      break;
-    case lisp::Atom::ATOM_INTEGER :
-      integer = other.integer;
-      break;
-    case lisp::Atom::ATOM_SYMBOL :
-      symbol       = other.symbol;
-      other.symbol = nullptr;
-      break;
-    case lisp::Atom::ATOM_STRING :
-      string       = other.string;
-      other.string = nullptr;
-      break;
-    case lisp::Atom::ATOM_LAMBDA :
-      lambda           = other.lambda;
-      other.lambda.env = nullptr;
-      break;
-    case lisp::Atom::ATOM_MACRO :
-      macro = other.macro;
-      break;
-    case lisp::Atom::ATOM_NATIVE :
-      native = other.native;
-      break;
-    case lisp::Atom::ATOM_ERROR :
-      error       = other.error;
-      other.error = nullptr;
-      break;
-  }
+  return is_real() || is_integer() || is_bignum();
 }
 
-bool Atom::is_numeric() const
-{
-  return type == Atom::ATOM_INTEGER || type == Atom::ATOM_REAL;
-}
-double Atom::as_numeric() const
-{
-  if( type == Atom::ATOM_INTEGER )
-  {
-    return ( double ) integer;
-  }
-  else if( type == Atom::ATOM_REAL )
-  {
-    return real;
-  }
-  else
-  {
-    UNREACHABLE;
-    return 0;
-  }
-}
-
-bool Atom::is_truthy() const
+bool Expr::is_symbol() const
 {
-  switch( type )
-  {
-    case lisp::Atom::ATOM_NIL :
-      return false;
-    case lisp::Atom::ATOM_BOOLEAN :
-      return boolean;
-    case lisp::Atom::ATOM_REAL :
-      return real != 0;
-    case lisp::Atom::ATOM_INTEGER :
-      return integer != 0;
-    case lisp::Atom::ATOM_STRING :
-      return ( string != nullptr ) && ( string[0] != '\0' );
-    case lisp::Atom::ATOM_ERROR :
-      return false;
-    case lisp::Atom::ATOM_SYMBOL :
-    case lisp::Atom::ATOM_LAMBDA :
-    case lisp::Atom::ATOM_NATIVE :
-    case lisp::Atom::ATOM_MACRO :
-      return false;
-  }
-
-  UNREACHABLE
-  return false;
+  return type == Expr::EXPR_SYMBOL;
 }
 
-std::string Atom::to_json() const
+// the order of two integers, either of which may be a bignum
+static int compare_integers( const Expr & a, const Expr & b )
 {
-  switch( type )
+  if( a.is_integer() && b.is_integer() )
   {
-    case Atom::ATOM_NIL :
-      return "null";
-    case Atom ::ATOM_BOOLEAN :
-      return ( boolean ? KW_TRUE : KW_FALSE );
-    case Atom::ATOM_REAL :
-      return std::to_string( real );
-    case Atom::ATOM_INTEGER :
-      return std::to_string( integer );
-    case Atom::ATOM_SYMBOL :
-      {
-        std::ostringstream os;
-        os << "\"symbol(" << symbol << ")\"";
-        return os.str();
-      }
-    case Atom::ATOM_STRING :
-      {
-        std::ostringstream os;
-        os << "\"" << string << "\"";
-        return os.str();
-      }
-    case Atom::ATOM_LAMBDA :
-      return "{ \"lambda\": { \"params\": " + lambda.params->to_json() + ", \"body\": " + lambda.body->to_json()
-             + " } }";
-    case Atom::ATOM_MACRO :
-      return "{ \"macro\": { \"params\": " + macro.params->to_json() + ", \"body\": " + macro.body->to_json() + " } }";
-    case Atom::ATOM_NATIVE :
-      return "\"native()\"";
-    case Atom ::ATOM_ERROR :
-      return "\"error(" + std::string( error ) + ")\"";
+    return ( a.integer > b.integer ) - ( a.integer < b.integer );
   }
 
-  UNREACHABLE
-  return "";
+  Bignum x = a.is_bignum() ? *a.bignum : Bignum( a.integer );
+  Bignum y = b.is_bignum() ? *b.bignum : Bignum( b.integer );
+  return Bignum::compare( x, y );
 }
 
-bool Atom::operator==( const Atom & other ) const
+bool Expr::operator==( const Expr & other ) const
 {
-  if( is_numeric() && other.is_numeric() )
+  if( is_number() && other.is_number() )
   {
-    return as_numeric() == other.as_numeric();
+    if( is_real() || other.is_real() )
+    {
+      return as_number() == other.as_number();
+    }
+    return compare_integers( *this, other ) == 0;
   }
   else if( type != other.type )
   {
@@ -454,24 +460,27 @@ bool Atom::operator==( const Atom & other ) const
 
   switch( type )
   {
-    case lisp::Atom::ATOM_NIL :
+    case Expr::EXPR_VOID :
+    case Expr::EXPR_NIL :
       return true;
-    case lisp::Atom::ATOM_BOOLEAN :
+    case Expr::EXPR_BOOLEAN :
       return boolean == other.boolean;
-    case lisp::Atom::ATOM_REAL :
+    case Expr::EXPR_REAL :
       return real == other.real;
-    case lisp::Atom::ATOM_INTEGER :
-      return integer == other.integer;
-    case lisp::Atom::ATOM_SYMBOL :
-      return ( strcmp( symbol, other.symbol ) == 0 );
-    case lisp::Atom::ATOM_STRING :
-      return ( strcmp( string, other.string ) == 0 );
-    case lisp::Atom::ATOM_MACRO :
-    case lisp::Atom::ATOM_LAMBDA :
+    case Expr::EXPR_INTEGER :
+    case Expr::EXPR_BIGNUM :
+      return compare_integers( *this, other ) == 0;
+    case Expr::EXPR_SYMBOL :
+      return symbol == other.symbol;
+    case Expr::EXPR_STRING :
+      return string->view() == other.string->view();
+    case Expr::EXPR_CONS :
+    case Expr::EXPR_MACRO :
+    case Expr::EXPR_LAMBDA :
       return false;
-    case lisp::Atom::ATOM_NATIVE :
+    case Expr::EXPR_NATIVE :
       return native == other.native;
-    case lisp::Atom::ATOM_ERROR :
+    case Expr::EXPR_ERROR :
       return ( strcmp( error, other.error ) == 0 );
   }
 
@@ -479,35 +488,16 @@ bool Atom::operator==( const Atom & other ) const
   return false;
 }
 
-bool Atom::operator>( const Atom & other ) const
+bool Expr::operator>( const Expr & other ) const
 {
-  if( is_numeric() && other.is_numeric() )
-  {
-    return as_numeric() > other.as_numeric();
-  }
-  else if( type != other.type )
-  {
-    return false;
-  }
-
-  switch( type )
+  if( is_number() && other.is_number() )
   {
-    case lisp::Atom::ATOM_REAL :
-      return real > other.real;
-    case lisp::Atom::ATOM_INTEGER :
-      return integer > other.integer;
-    case lisp::Atom::ATOM_NIL :
-    case lisp::Atom::ATOM_BOOLEAN :
-    case lisp::Atom::ATOM_SYMBOL :
-    case lisp::Atom::ATOM_STRING :
-    case lisp::Atom::ATOM_LAMBDA :
-    case lisp::Atom::ATOM_NATIVE :
-    case lisp::Atom::ATOM_ERROR :
-    case lisp::Atom::ATOM_MACRO :
-      return false;
+    if( is_real() || other.is_real() )
+    {
+      return as_number() > other.as_number();
+    }
+    return compare_integers( *this, other ) > 0;
   }
-
-  UNREACHABLE
   return false;
 }
 
@@ -530,12 +520,42 @@ std::string Expr::to_json() const
 {
   switch( type )
   {
-    case Expr::EXPR_ATOM :
-      return atom.to_json();
-    case Expr::EXPR_CONS :
-      return cons.to_json();
     case Expr::EXPR_VOID :
       return "{}";
+    case Expr::EXPR_CONS :
+      return cons.to_json();
+    case Expr::EXPR_NIL :
+      return "null";
+    case Expr::EXPR_BOOLEAN :
+      return ( boolean ? KW_TRUE : KW_FALSE );
+    case Expr::EXPR_REAL :
+      return std::to_string( real );
+    case Expr::EXPR_INTEGER :
+      return std::to_string( integer );
+    case Expr::EXPR_BIGNUM :
+      return bignum->to_string();
+    case Expr::EXPR_SYMBOL :
+      {
+        std::ostringstream os;
+        os << "\"symbol(" << symbol << ")\"";
+        return os.str();
+      }
+    case Expr::EXPR_STRING :
+      {
+        std::ostringstream os;
+        os << "\"" << string->view() << "\"";
+        return os.str();
+      }
+    case Expr::EXPR_LAMBDA :
+      return "{ \"lambda\": { \"params\": " + lambda->params->to_json() + ", \"body\": " + lambda->body->to_json()
+             + " } }";
+    case Expr::EXPR_MACRO :
+      return "{ \"macro\": { \"params\": " + macro->params->to_json() + ", \"body\": " + macro->body->to_json()
+             + " } }";
+    case Expr::EXPR_NATIVE :
+      return "\"native()\"";
+    case Expr::EXPR_ERROR :
+      return "\"error(" + std::string( error ) + ")\"";
   }
 
   UNREACHABLE
@@ -546,43 +566,36 @@ std::string to_string( Expr * expr )
 {
   switch( expr->type )
   {
-    case Expr::EXPR_ATOM :
+    case Expr::EXPR_NIL :
+      return "nil";
+    case Expr::EXPR_BOOLEAN :
+      return ( expr->boolean ? KW_TRUE : KW_FALSE );
+    case Expr::EXPR_STRING :
+      return std::string( expr->string->view() );
+    case Expr::EXPR_SYMBOL :
+      return std::string( expr->symbol );
+    case Expr::EXPR_ERROR :
+      return "(error: " + std::string( expr->error ) + ")";
+    case Expr::EXPR_REAL :
       {
-        switch( expr->atom.type )
-        {
-          case Atom ::ATOM_NIL :
-            return "nil";
-          case Atom ::ATOM_BOOLEAN :
-            return ( expr->atom.boolean ? KW_TRUE : KW_FALSE );
-          case Atom ::ATOM_STRING :
-            return std::string( expr->atom.string );
-          case Atom ::ATOM_SYMBOL :
-            return std::string( expr->atom.symbol );
-          case Atom ::ATOM_ERROR :
-            return "(error: " + std::string( expr->atom.error ) + ")";
-          case Atom ::ATOM_REAL :
-            {
-              std::stringstream ss;
-              ss << expr->atom.real;
-              return ss.str();
-            }
-          case Atom ::ATOM_INTEGER :
-            {
-              std::stringstream ss;
-              ss << expr->atom.integer;
-              return ss.str();
-            }
-          case Atom::ATOM_LAMBDA :
-            return "(lambda-fn)";
-          case Atom::ATOM_NATIVE :
-            return "(native-fn)";
-          case Atom::ATOM_MACRO :
-            return "(macro-fn)";
-        }
-
-        UNREACHABLE;
-        return "";
+        std::stringstream ss;
+        ss << expr->real;
+        return ss.str();
+      }
+    case Expr::EXPR_INTEGER :
+      {
+        std::stringstream ss;
+        ss << expr->integer;
+        return ss.str();
       }
+    case Expr::EXPR_BIGNUM :
+      return expr->bignum->to_string();
+    case Expr::EXPR_LAMBDA :
+      return "(lambda-fn)";
+    case Expr::EXPR_NATIVE :
+      return "(native-fn)";
+    case Expr::EXPR_MACRO :
+      return "(macro-fn)";
     case Expr::EXPR_CONS :
       {
         std::string str = "(";
@@ -604,27 +617,19 @@ std::string to_string_repr( Expr * expr )
 {
   switch( expr->type )
   {
-    case Expr ::EXPR_ATOM :
+    case Expr::EXPR_STRING :
       {
-        switch( expr->atom.type )
-        {
-          case Atom ::ATOM_STRING :
-            {
-              std::ostringstream os;
-              os << "\"" << expr->atom.string << "\"";
-              return os.str();
-            }
-          case Atom ::ATOM_ERROR :
-            {
-              std::ostringstream os;
-              os << "(error \"" << expr->atom.error << "\")";
-              return os.str();
-            }
-          default :
-            return to_string( expr );
-        }
+        std::ostringstream os;
+        os << "\"" << expr->string->view() << "\"";
+        return os.str();
       }
-    case Expr ::EXPR_CONS :
+    case Expr::EXPR_ERROR :
+      {
+        std::ostringstream os;
+        os << "(error \"" << expr->error << "\")";
+        return os.str();
+      }
+    case Expr::EXPR_CONS :
       {
         Expr * it       = expr;
         std::string str = "(";
@@ -653,7 +658,7 @@ std::string to_string_repr( Expr * expr )
         return str;
       }
     default :
-      return "";
+      return to_string( expr );
   }
 }
 
@@ -1,12 +1,17 @@
 #pragma once
 
+#include "bignum.h"
 #include "builtin.h"
 #include "gc.h"
 #include "util.h"
 
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 #include <list>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 #ifdef __unix__
@@ -21,6 +26,12 @@ namespace lisp
 ///////////////////////////////////////////////////////////////////////////////
 
 struct Expr;
+class Node;
+
+namespace vm
+{
+class Chunk;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -29,6 +40,8 @@ struct Macro
   Expr * params;
   Expr * body;
   Context * env;
+  Node * code;       // the analyzed body, once the macro was expanded
+  vm::Chunk * chunk; // the compiled body, once the macro was expanded
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -38,87 +51,136 @@ struct Lambda
   Expr * params;
   Expr * body;
   Context * env;
+  bool escapes;      // calls may create closures, so their frames live on the heap
+  Node * code;       // the analyzed body, once the lambda was called
+  vm::Chunk * chunk; // the compiled body, once the lambda was called
 };
 
 ///////////////////////////////////////////////////////////////////////////////
 
-struct Atom
+struct Cons
 {
-  enum Type
-  {
-    ATOM_NIL,
-    ATOM_BOOLEAN,
-    ATOM_REAL,
-    ATOM_INTEGER,
-    ATOM_SYMBOL,
-    ATOM_STRING,
-    ATOM_LAMBDA,
-    ATOM_NATIVE,
-    ATOM_ERROR,
-    ATOM_MACRO,
-  };
+  Expr * car; // data
+  Expr * cdr; // next
 
-  Type type;
-  union
+  Cons( Expr * _car, Expr * _cdr );
+
+  std::string to_json() const;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+// immutable, reference counted string data. the length is stored in front of
+// the characters, which may contain '\0' and are always followed by one.
+class String
+{
+public:
+  static String * make( const char * data, std::size_t length );
+
+  String * retain()
   {
-    bool boolean;
-    double real;
-    int integer;
-    char * symbol;
-    char * string;
-    char * error;
-    Lambda lambda;
-    Native native;
-    Macro macro;
-  };
+    m_refs++;
+    return this;
+  }
 
-  ~Atom();
-  Atom();
-  Atom( Atom && other ) noexcept;
+  void release();
 
-  bool is_truthy() const;
-  bool is_numeric() const;
-  double as_numeric() const;
+  std::size_t length() const
+  {
+    return m_length;
+  }
 
-  std::string to_json() const;
+  const char * data() const
+  {
+    return m_data;
+  }
 
-  bool operator==( const Atom & other ) const;
-  bool operator>( const Atom & other ) const;
+  std::string_view view() const
+  {
+    return std::string_view( m_data, m_length );
+  }
+
+private:
+  std::size_t m_refs;
+  std::size_t m_length;
+  char m_data[1];
 };
 
 ///////////////////////////////////////////////////////////////////////////////
 
-struct Cons
+// ids of the interned symbols that eval() dispatches on. every other symbol
+// gets a larger id, all cells that are not symbols have SYM_NONE.
+enum SymbolId : std::uint32_t
 {
-  Expr * car; // data
-  Expr * cdr; // next
-
-  Cons( Expr * _car, Expr * _cdr );
-
-  std::string to_json() const;
+  SYM_NONE,
+  SYM_QUOTE,
+  SYM_UNQUOTE,
+  SYM_UNQUOTE_SPLICE,
+  SYM_QUASIQUOTE,
+  SYM_DEFINE,
+  SYM_LAMBDA,
+  SYM_IF,
+  SYM_PROGN,
+  SYM_LET,
+  SYM_COND,
+  SYM_OR,
+  SYM_AND,
+  SYM_MACRO,
+  SYM_TO_STREAM,
+  SYM_FROM_STREAM,
+  SYM_PIPE,
+  SYM_CONS,
+  SYM_APPEND,
+  SYM_WHILE,
+  SYM_DOTIMES,
+  SYM_DOLIST,
+  SYM_KEYWORD_COUNT,
 };
 
 ///////////////////////////////////////////////////////////////////////////////
 
+// a cell is the one byte gc header, a one byte type tag, the four byte symbol
+// id and a 16 byte payload, 24 bytes in all. the id fills the word the header
+// and the tag start and is SYM_NONE for everything but symbols. anything that
+// does not fit into the payload is stored out of line.
 struct Expr : public gc::Garbage
 {
-  enum Type
+  enum Type : std::uint8_t
   {
     EXPR_VOID,
-    EXPR_ATOM,
     EXPR_CONS,
+    EXPR_NIL,
+    EXPR_BOOLEAN,
+    EXPR_REAL,
+    EXPR_INTEGER,
+    EXPR_SYMBOL,
+    EXPR_STRING,
+    EXPR_LAMBDA,
+    EXPR_NATIVE,
+    EXPR_ERROR,
+    EXPR_MACRO,
+    EXPR_BIGNUM,
   };
 
   Type type;
+  std::uint32_t id;
   union
   {
-    Atom atom;
+    bool boolean;
+    double real;
+    std::int64_t integer;
+    char * symbol;
+    String * string;
+    char * error;
+    Lambda * lambda;
+    const NativeDef * native;
+    Macro * macro;
+    Bignum * bignum;
     Cons cons;
   };
 
   ~Expr();
-  Expr();
-  Expr( Atom && a );
+  explicit Expr( Type t = EXPR_VOID );
   Expr( Cons c );
 
   std::string to_json() const;
@@ -126,14 +188,16 @@ struct Expr : public gc::Garbage
   bool is_void() const;
   bool is_cons() const;
   bool is_atom() const;
-  bool is_atom( Atom::Type atype ) const;
+  bool is_type( Type t ) const;
   bool is_nil() const;
   bool is_string() const;
   bool is_real() const;
   bool is_integer() const;
+  bool is_bignum() const;
   bool is_number() const;
   bool is_symbol() const;
   bool is_symbol( const char * symbol ) const;
+  bool is_symbol( SymbolId symbol_id ) const;
   bool is_lambda() const;
   bool is_native() const;
   bool is_procedure() const;
@@ -141,20 +205,34 @@ struct Expr : public gc::Garbage
   bool is_macro() const;
   bool is_truthy() const;
 
-  void mark() override;
+  void mark();
 
   Expr * car();
   Expr * cdr();
 
   bool as_boolean() const;
   double as_real() const;
-  int as_integer() const;
+  std::int64_t as_integer() const;
   double as_number() const;
   const char * as_string() const;
   const char * as_error() const;
   const char * as_symbol() const;
+
+  bool operator==( const Expr & other ) const;
+  bool operator>( const Expr & other ) const;
 };
 
+// nil, void, the booleans and small integers are preallocated outside of the
+// heap and shared, making them never allocates. they must not be modified.
+constexpr int SMALL_INTEGER_MIN = -128;
+constexpr int SMALL_INTEGER_MAX = 1023;
+
+extern Expr NIL_EXPR;
+extern Expr VOID_EXPR;
+extern Expr TRUE_EXPR;
+extern Expr FALSE_EXPR;
+extern Expr SMALL_INTEGERS[SMALL_INTEGER_MAX - SMALL_INTEGER_MIN + 1];
+
 Expr * cast_to_string( Expr * );
 
 std::string to_string( Expr * expr );
@@ -165,12 +243,12 @@ std::string to_string_repr( Expr * expr );
 
 inline Expr * make_void()
 {
-  return gc::alloc<Expr>();
+  return &VOID_EXPR;
 }
 
-inline Expr * make_expr( Atom && atom )
+inline Expr * make_expr( Expr::Type type )
 {
-  return gc::alloc<Expr>( std::move( atom ) );
+  return gc::alloc<Expr>( type );
 }
 
 inline Expr * make_expr( Cons cons )
@@ -180,7 +258,7 @@ inline Expr * make_expr( Cons cons )
 
 inline Expr * make_nil()
 {
-  return gc::alloc<Expr>( Atom() );
+  return &NIL_EXPR;
 }
 
 inline Expr * make_cons( Expr * a, Expr * b )
@@ -191,101 +269,111 @@ inline Expr * make_cons( Expr * a, Expr * b )
 
 inline Expr * make_boolean( bool boolean )
 {
-  Atom atom;
-  atom.type    = Atom::ATOM_BOOLEAN;
-  atom.boolean = boolean;
-  return make_expr( std::move( atom ) );
+  return boolean ? &TRUE_EXPR : &FALSE_EXPR;
 }
 
 inline Expr * make_real( double real )
 {
-  Atom atom;
-  atom.type = Atom::ATOM_REAL;
-  atom.real = real;
-  return make_expr( std::move( atom ) );
+  Expr * expr = make_expr( Expr::EXPR_REAL );
+  expr->real  = real;
+  return expr;
 }
 
-inline Expr * make_integer( int integer )
+inline Expr * make_integer( std::int64_t integer )
 {
-  Atom atom;
-  atom.type    = Atom::ATOM_INTEGER;
-  atom.integer = integer;
-  return make_expr( std::move( atom ) );
+  if( SMALL_INTEGER_MIN <= integer && integer <= SMALL_INTEGER_MAX )
+  {
+    return &SMALL_INTEGERS[integer - SMALL_INTEGER_MIN];
+  }
+
+  Expr * expr   = make_expr( Expr::EXPR_INTEGER );
+  expr->integer = integer;
+  return expr;
 }
 
-inline Expr * make_symbol( const char * symbol )
+// integers that fit into 64 bits are never stored as bignums
+inline Expr * make_bignum( Bignum bignum )
 {
-  Atom atom;
-  atom.type   = Atom::ATOM_SYMBOL;
-  atom.symbol = STRDUP( symbol );
-  return make_expr( std::move( atom ) );
+  if( bignum.is_small() )
+  {
+    return make_integer( bignum.to_small() );
+  }
+
+  Expr * expr  = make_expr( Expr::EXPR_BIGNUM );
+  expr->bignum = new Bignum( std::move( bignum ) );
+  return expr;
 }
 
+// symbols are interned, there is only one cell for every name and it is
+// never collected
+Expr * make_symbol( const char * symbol );
+
 inline Expr * make_error( const char * error )
 {
-  Atom atom;
-  atom.type  = Atom::ATOM_ERROR;
-  atom.error = STRDUP( error );
-  return make_expr( std::move( atom ) );
+  Expr * expr = make_expr( Expr::EXPR_ERROR );
+  expr->error = STRDUP( error );
+  return expr;
+}
+
+inline Expr * make_string( String * string )
+{
+  Expr * expr  = make_expr( Expr::EXPR_STRING );
+  expr->string = string->retain();
+  return expr;
+}
+
+inline Expr * make_string( const char * data, std::size_t length )
+{
+  Expr * expr  = make_expr( Expr::EXPR_STRING );
+  expr->string = String::make( data, length );
+  return expr;
 }
 
 inline Expr * make_string( const char * string )
 {
-  Atom atom;
-  atom.type   = Atom::ATOM_STRING;
-  atom.string = STRDUP( string );
-  return make_expr( std::move( atom ) );
+  return make_string( string, strlen( string ) );
 }
 
-inline Expr * make_string_take_ownership( char * string )
+inline Expr * make_string( const std::string & string )
 {
-  Atom atom;
-  atom.type   = Atom::ATOM_STRING;
-  atom.string = string;
-  return make_expr( std::move( atom ) );
+  return make_string( string.data(), string.size() );
 }
 
-inline Expr * make_native( Native fn )
+inline Expr * make_native( const NativeDef * native )
 {
-  Atom atom;
-  atom.type   = Atom::ATOM_NATIVE;
-  atom.native = fn;
-  return make_expr( std::move( atom ) );
+  Expr * expr  = make_expr( Expr::EXPR_NATIVE );
+  expr->native = native;
+  return expr;
 }
 
+// true if 'body' contains a lambda or macro definition that could capture the
+// environment it is evaluated in
+bool may_capture( Expr * body );
+
 inline Expr * make_lambda( Expr * params, Expr * body, Context * env )
 {
-  Atom atom;
-  atom.type   = Atom::ATOM_LAMBDA;
-  atom.lambda = Lambda{ params, body, env };
-  return make_expr( std::move( atom ) );
+  Expr * expr  = make_expr( Expr::EXPR_LAMBDA );
+  expr->lambda = new Lambda{ params, body, env, may_capture( body ), nullptr, nullptr };
+  return expr;
 }
 
 inline Expr * make_macro( Expr * params, Expr * body, Context * env )
 {
-  Atom atom;
-  atom.type  = Atom::ATOM_MACRO;
-  atom.macro = Macro{ params, body, env };
-  return make_expr( std::move( atom ) );
+  Expr * expr = make_expr( Expr::EXPR_MACRO );
+  expr->macro = new Macro{ params, body, env, nullptr, nullptr };
+  return expr;
 }
 
 inline Expr * make_copy( Expr * e )
 {
   switch( e->type )
   {
-    case Expr::EXPR_ATOM :
-      {
-        switch( e->atom.type )
-        {
-          case Atom::ATOM_REAL :
-            return make_real( e->atom.real );
-          case Atom::ATOM_INTEGER :
-            return make_integer( e->atom.integer );
-          default :
-            break;
-        }
-        break;
-      }
+    case Expr::EXPR_REAL :
+      return make_real( e->real );
+    case Expr::EXPR_INTEGER :
+      return make_integer( e->integer );
+    case Expr::EXPR_BIGNUM :
+      return make_bignum( *e->bignum );
     default :
       break;
   }
@@ -323,7 +411,8 @@ public:
     else
     {
       tail->cons.cdr = cons;
-      tail           = tail->cdr();
+      gc::write_barrier( tail, cons );
+      tail = tail->cdr();
     }
   }
 
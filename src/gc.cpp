@@ -1,5 +1,22 @@
 #include "gc.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+#if defined( __GNUC__ ) || defined( __clang__ )
+#define NO_SANITIZE_ADDRESS __attribute__( ( no_sanitize_address ) )
+#define NO_INLINE __attribute__( ( noinline ) )
+#else
+#define NO_SANITIZE_ADDRESS
+#define NO_INLINE
+#endif
+
 namespace lisp
 {
 
@@ -7,88 +24,851 @@ namespace lisp
 
 namespace gc
 {
-std::list<Garbage *> Garbage::heap;
+
+// run a full collection once this many objects have been promoted, or once
+// the old generation has doubled since the last full collection
+constexpr std::size_t MIN_THRESHOLD = 64 * 1024;
+
+Stats stats = { 0, 0, 0, 0, MIN_THRESHOLD, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+Phase phase = PHASE_IDLE;
+
+static Mode gc_mode = INCREMENTAL;
+
+static std::size_t step_budget = DEFAULT_STEP_BUDGET;
+
+static std::size_t min_threshold = MIN_THRESHOLD;
+
+static std::size_t heap_limit = 0;
+
+struct Root
+{
+  Garbage * obj;
+  Space::Trace trace;
+};
+
+static std::vector<Root> roots;
+
+// old objects that had references to young objects stored into them
+static std::vector<Garbage *> remembered;
+
+static std::vector<Garbage *> gray;
+
+static std::vector<Garbage *> minor_gray;
+
+static std::vector<Space *> spaces;
+
+// all pages of all spaces, sorted by address
+static std::vector<Page *> page_index;
+
+// only young objects are marked during a nursery collection
+static bool minor_mode = false;
+
+///////////////////////////////////////////////////////////////////////////////
+
+// measures the time the mutator is stopped, nested pauses count only once
+class Pause
+{
+public:
+  Pause()
+  {
+    if( depth++ == 0 )
+    {
+      start = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~Pause()
+  {
+    if( --depth == 0 )
+    {
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      auto ns      = std::chrono::duration_cast<std::chrono::nanoseconds>( elapsed ).count();
+      stats.total_pause_ns += ns;
+      stats.max_pause_ns = std::max<std::size_t>( stats.max_pause_ns, ns );
+    }
+  }
+
+private:
+  static int depth;
+  static std::chrono::steady_clock::time_point start;
+};
+
+int Pause::depth = 0;
+std::chrono::steady_clock::time_point Pause::start;
 
 ///////////////////////////////////////////////////////////////////////////////
 
 Garbage::Garbage()
-    : m_marked( false )
+    : m_flags( 0 )
 {
 }
 
 bool Garbage::is_marked() const
 {
-  return m_marked;
+  return m_flags & FLAG_MARKED;
 }
 
 void Garbage::set_marked( bool b )
 {
-  m_marked = b;
+  m_flags = b ? ( m_flags | FLAG_MARKED ) : ( m_flags & ~FLAG_MARKED );
+}
+
+void Garbage::set_old( bool b )
+{
+  m_flags = b ? ( m_flags | FLAG_OLD ) : ( m_flags & ~FLAG_OLD );
+}
+
+void Garbage::set_remembered( bool b )
+{
+  m_flags = b ? ( m_flags | FLAG_REMEMBERED ) : ( m_flags & ~FLAG_REMEMBERED );
+}
+
+void Garbage::set_minor_marked( bool b )
+{
+  m_flags = b ? ( m_flags | FLAG_MINOR_MARKED ) : ( m_flags & ~FLAG_MINOR_MARKED );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static std::size_t round_up( std::size_t size, std::size_t align )
+{
+  return ( size + align - 1 ) & ~( align - 1 );
+}
+
+Space::Space( std::size_t cell_size, std::size_t align, Trace trace, Destroy destroy )
+    : m_cell_size( round_up( std::max( cell_size, sizeof( FreeCell ) ), std::max( align, alignof( FreeCell ) ) ) )
+    , m_trace( trace )
+    , m_destroy( destroy )
+    , m_next_page( 0 )
+    , m_bump( nullptr )
+    , m_limit( nullptr )
+    , m_free( nullptr )
+{
+  spaces.push_back( this );
+}
+
+Page * Space::new_page()
+{
+  void * memory = std::aligned_alloc( PAGE_SIZE, PAGE_SIZE );
+  if( memory == nullptr )
+  {
+    throw std::bad_alloc();
+  }
+
+  // header, one 'used' byte per cell, then the (aligned) cells
+  std::size_t align = alignof( std::max_align_t );
+  std::size_t count = ( PAGE_SIZE - sizeof( Page ) - align ) / ( m_cell_size + 1 );
+  std::size_t start = round_up( sizeof( Page ) + count, align );
+
+  Page * page      = static_cast<Page *>( memory );
+  page->space      = this;
+  page->cell_size  = m_cell_size;
+  page->cell_count = count;
+  page->live       = 0;
+  page->cells      = static_cast<char *>( memory ) + start;
+  std::memset( page->used, 0, count );
+
+  page_index.insert( std::upper_bound( page_index.begin(), page_index.end(), page ), page );
+  stats.pages++;
+  return page;
+}
+
+void Space::free_page( Page * page )
+{
+  page_index.erase( std::lower_bound( page_index.begin(), page_index.end(), page ) );
+  std::free( page );
+  stats.pages--;
+}
+
+// continues with the next empty nursery page
+bool Space::next_nursery_page()
+{
+  while( m_next_page < m_nursery.size() )
+  {
+    Page * page = m_nursery[m_next_page++];
+    if( page->live == 0 )
+    {
+      m_bump  = page->cells;
+      m_limit = page->end();
+      return true;
+    }
+  }
+  return false;
+}
+
+void * Space::allocate_slow()
+{
+  // an incremental collection makes progress whenever a page has been used up
+  if( phase != PHASE_IDLE )
+  {
+    step();
+    if( m_bump < m_limit || m_free != nullptr )
+    {
+      return allocate();
+    }
+  }
+
+  if( next_nursery_page() )
+  {
+    return allocate();
+  }
+
+  if( m_nursery.size() >= NURSERY_PAGES )
+  {
+    minor();
+    if( m_bump < m_limit || m_free != nullptr )
+    {
+      return allocate();
+    }
+  }
+
+  // the nursery is still filling up, or everything in it survived
+  if( heap_limit != 0 && ( stats.pages + 1 ) * PAGE_SIZE > heap_limit )
+  {
+    // the heap only grows if a full collection does not make room, either
+    // in the cells it freed or in the pages it emptied
+    run();
+    if( m_free != nullptr || next_nursery_page() )
+    {
+      return allocate();
+    }
+    if( ( stats.pages + 1 ) * PAGE_SIZE > heap_limit )
+    {
+      throw HeapLimitExceeded();
+    }
+  }
+
+  Page * page = new_page();
+  m_nursery.push_back( page );
+  m_next_page = m_nursery.size();
+  m_bump      = page->cells;
+  m_limit     = page->end();
+  return allocate();
 }
 
-void mark( Garbage * expr )
+bool Space::sweep_page( Page * page, bool young )
 {
-#if 0
-   expr->m_marked = true;
-   if( expr->is_cons() )
-   {
-      mark( expr->cons.cdr );
-      mark( expr->cons.car );
-   }
-   else if( expr->is_atom() )
-   {
-      // closures?
-      if( expr->is_lambda() )
+  for( std::size_t i = 0; i < page->cell_count; i++ )
+  {
+    if( !page->used[i] )
+    {
+      continue;
+    }
+
+    Garbage * obj = static_cast<Garbage *>( page->cell( i ) );
+    if( young && obj->is_old() )
+    {
+      continue;
+    }
+
+    if( young && obj->is_minor_marked() )
+    {
+      obj->set_minor_marked( false );
+      obj->set_old( true );
+      stats.old_size++;
+      stats.promoted++;
+
+      // the running full collection may not have seen this object yet
+      if( phase == PHASE_MARKING )
       {
-         for( auto & [k, v] : expr->atom.lambda.closure->env() )
-         {
-            mark( v );
-         }
+        shade( obj );
       }
-   }
-#endif
+      continue;
+    }
+
+    if( !young && obj->is_marked() )
+    {
+      obj->set_marked( false );
+      if( !obj->is_old() )
+      {
+        obj->set_old( true );
+        stats.old_size++;
+        stats.promoted++;
+      }
+      continue;
+    }
+
+    if( obj->is_old() )
+    {
+      stats.old_size--;
+    }
+
+    m_destroy( obj );
+    page->used[i] = 0;
+    page->live--;
+    stats.heap_size--;
+    stats.freed++;
+  }
+
+  return page->live == 0;
 }
 
-void sweep()
+void Space::reset_nursery()
 {
-  auto it = Garbage::heap.begin();
-  while( it != Garbage::heap.end() )
+  // pages that are mostly occupied by promoted objects leave the nursery
+  auto full = std::stable_partition(
+      m_nursery.begin(), m_nursery.end(), []( Page * page ) { return page->live <= page->cell_count * 3 / 4; } );
+  m_old.insert( m_old.end(), full, m_nursery.end() );
+  m_nursery.erase( full, m_nursery.end() );
+
+  // give back empty pages beyond the nursery size
+  for( auto it = m_nursery.begin(); it != m_nursery.end() && m_nursery.size() > NURSERY_PAGES; )
   {
-    Garbage * g = *it;
-    if( !g->is_marked() )
+    if( ( *it )->live == 0 )
     {
-      delete g;
-      it = Garbage::heap.erase( it );
+      free_page( *it );
+      it = m_nursery.erase( it );
     }
     else
     {
-      g->set_marked( false );
       ++it;
     }
   }
+
+  // the holes in partially occupied pages are handed out before empty pages
+  m_free           = nullptr;
+  FreeCell ** tail = &m_free;
+  for( Page * page : m_nursery )
+  {
+    if( page->live == 0 )
+    {
+      continue;
+    }
+
+    for( std::size_t i = 0; i < page->cell_count; i++ )
+    {
+      if( !page->used[i] )
+      {
+        FreeCell * cell = static_cast<FreeCell *>( page->cell( i ) );
+        *tail           = cell;
+        tail            = &cell->next;
+      }
+    }
+  }
+  *tail = nullptr;
+
+  m_next_page = 0;
+  m_bump      = nullptr;
+  m_limit     = nullptr;
 }
 
-void delete_all()
+void Space::sweep_nursery()
+{
+  for( Page * page : m_nursery )
+  {
+    sweep_page( page, true );
+  }
+  reset_nursery();
+}
+
+void Space::mark_nursery()
 {
-  for( Garbage * g : Garbage::heap )
+  for( Page * page : m_nursery )
   {
-    delete g;
+    for( std::size_t i = 0; i < page->cell_count; i++ )
+    {
+      Garbage * obj = static_cast<Garbage *>( page->cell( i ) );
+      if( page->used[i] && !obj->is_old() && obj->is_marked() )
+      {
+        mark( obj );
+      }
+    }
   }
-  Garbage::heap.clear();
 }
 
-#if 0
-void run( Context & context )
+void Space::begin_sweep()
 {
-   for( const auto & [symbol, expr] : context.env() )
-   {
-      mark( expr );
-   }
+  // pages that become old from now on were not marked and must not be swept,
+  // that includes the nursery pages reset_nursery() moves to the old pages
+  m_sweep_queue.insert( m_sweep_queue.end(), m_old.begin(), m_old.end() );
+  m_old.clear();
 
-   sweep();
+  for( Page * page : m_nursery )
+  {
+    sweep_page( page, false );
+  }
+  reset_nursery();
 }
+
+bool Space::sweep_step( std::size_t budget )
+{
+  for( ; budget > 0 && !m_sweep_queue.empty(); budget-- )
+  {
+    Page * page = m_sweep_queue.back();
+    m_sweep_queue.pop_back();
+
+    if( sweep_page( page, false ) )
+    {
+      free_page( page );
+    }
+    else if( page->live < page->cell_count )
+    {
+      // pages with holes go back to the nursery so that the holes are reused
+      m_nursery.push_back( page );
+      for( std::size_t i = 0; i < page->cell_count; i++ )
+      {
+        if( !page->used[i] )
+        {
+          FreeCell * cell = static_cast<FreeCell *>( page->cell( i ) );
+          cell->next      = m_free;
+          m_free          = cell;
+        }
+      }
+    }
+    else
+    {
+      m_old.push_back( page );
+    }
+  }
+
+  return m_sweep_queue.empty();
+}
+
+void Space::sweep()
+{
+  begin_sweep();
+  sweep_step( SIZE_MAX );
+}
+
+void Space::release_all()
+{
+  for( std::vector<Page *> * pages : { &m_nursery, &m_old, &m_sweep_queue } )
+  {
+    for( Page * page : *pages )
+    {
+      for( std::size_t i = 0; i < page->cell_count; i++ )
+      {
+        if( page->used[i] )
+        {
+          m_destroy( page->cell( i ) );
+          stats.heap_size--;
+          stats.freed++;
+        }
+      }
+      free_page( page );
+    }
+    pages->clear();
+  }
+
+  m_next_page = 0;
+  m_bump      = nullptr;
+  m_limit     = nullptr;
+  m_free      = nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void mark( Garbage * obj )
+{
+  if( obj == nullptr )
+  {
+    return;
+  }
+
+  if( minor_mode )
+  {
+    if( !obj->is_old() && !obj->is_minor_marked() )
+    {
+      obj->set_minor_marked( true );
+      minor_gray.push_back( obj );
+    }
+    return;
+  }
+
+  if( !obj->is_marked() )
+  {
+    obj->set_marked( true );
+    gray.push_back( obj );
+  }
+}
+
+void shade( Garbage * obj )
+{
+  if( !obj->is_marked() )
+  {
+    obj->set_marked( true );
+    gray.push_back( obj );
+  }
+}
+
+// visit the references of a heap object
+static void trace( Garbage * obj )
+{
+  Page::of( obj )->space->trace( obj );
+}
+
+static void trace_roots()
+{
+  for( const Root & root : roots )
+  {
+    root.trace( root.obj );
+  }
+}
+
+// trace at most 'budget' gray objects, returns true if none are left
+static bool drain( std::vector<Garbage *> & stack, std::size_t budget = SIZE_MAX )
+{
+  for( ; budget > 0 && !stack.empty(); budget-- )
+  {
+    Garbage * obj = stack.back();
+    stack.pop_back();
+    trace( obj );
+  }
+  return stack.empty();
+}
+
+void remember( Garbage * obj )
+{
+  obj->set_remembered( true );
+  remembered.push_back( obj );
+}
+
+static void forget_remembered()
+{
+  for( Garbage * obj : remembered )
+  {
+    obj->set_remembered( false );
+  }
+  remembered.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+
+static void * stack_top()
+{
+  static thread_local void * top = nullptr;
+  if( top == nullptr )
+  {
+    pthread_attr_t attr;
+    void * addr;
+    std::size_t size;
+    pthread_getattr_np( pthread_self(), &attr );
+    pthread_attr_getstack( &attr, &addr, &size );
+    pthread_attr_destroy( &attr );
+    top = static_cast<char *>( addr ) + size;
+  }
+  return top;
+}
+
+// returns the live object containing 'ptr', if any
+static Garbage * find_object( std::uintptr_t ptr )
+{
+  Page * page = Page::of( reinterpret_cast<void *>( ptr ) );
+  if( !std::binary_search( page_index.begin(), page_index.end(), page ) )
+  {
+    return nullptr;
+  }
+
+  char * addr = reinterpret_cast<char *>( ptr );
+  if( addr < page->cells )
+  {
+    return nullptr;
+  }
+
+  std::size_t index = page->index_of( addr );
+  if( index >= page->cell_count || !page->used[index] )
+  {
+    return nullptr;
+  }
+
+  return static_cast<Garbage *>( page->cell( index ) );
+}
+
+// the stacks of threads that wait for the thread that runs the evaluator
+struct ParkedStack
+{
+  void * begin;
+  void * end;
+};
+
+static std::vector<ParkedStack> parked;
+
+NO_SANITIZE_ADDRESS static void scan_range( void * from, void * to )
+{
+  auto begin = reinterpret_cast<std::uintptr_t *>( from );
+  auto end   = reinterpret_cast<std::uintptr_t *>( to );
+  for( std::uintptr_t * it = begin; it < end; it++ )
+  {
+    mark( find_object( *it ) );
+  }
+}
+
+// natives and the evaluator hold intermediate values in local variables, so
+// every word on the stack that points into a heap object keeps it alive
+NO_SANITIZE_ADDRESS NO_INLINE static void scan_stack()
+{
+  void * marker = nullptr;
+  scan_range( &marker, stack_top() );
+  for( const ParkedStack & stack : parked )
+  {
+    scan_range( stack.begin, stack.end );
+  }
+}
+
+NO_INLINE static void mark_stack()
+{
+  // spill callee-saved registers so that they are scanned as well
+#if defined( __GNUC__ ) || defined( __clang__ )
+  __builtin_unwind_init();
+#endif
+  scan_stack();
+}
+
+NO_INLINE static void call_parked( void ( *fn )( void * ), void * arg )
+{
+  void * marker = nullptr;
+  parked.push_back( ParkedStack{ &marker, stack_top() } );
+  fn( arg );
+  parked.pop_back();
+}
+
+NO_INLINE void park_stack( void ( *fn )( void * ), void * arg )
+{
+#if defined( __GNUC__ ) || defined( __clang__ )
+  __builtin_unwind_init();
+#endif
+  call_parked( fn, arg );
+}
+
+#else
+
+void park_stack( void ( *fn )( void * ), void * arg )
+{
+  fn( arg );
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+
+void sweep()
+{
+  for( Space * space : spaces )
+  {
+    space->sweep();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+
+static void begin_cycle()
+{
+  phase = PHASE_MARKING;
+  trace_roots();
+  mark_stack();
+}
+
+// the roots and the stack are not covered by the write barrier, so they are
+// scanned again before the nursery is swept
+static void finish_marking()
+{
+  trace_roots();
+  mark_stack();
+  drain( gray );
+
+  for( Space * space : spaces )
+  {
+    space->begin_sweep();
+  }
+
+  // every young survivor is old now, so nothing old points to a young object
+  forget_remembered();
+  phase = PHASE_SWEEPING;
+}
+
+static bool sweep_step( std::size_t budget )
+{
+  bool done = true;
+  for( Space * space : spaces )
+  {
+    done = space->sweep_step( budget ) && done;
+  }
+
+  if( done )
+  {
+    phase = PHASE_IDLE;
+    stats.collections++;
+    stats.threshold = std::max( min_threshold, 2 * stats.old_size );
+  }
+  return done;
+}
+
+static void finish_cycle()
+{
+  if( phase == PHASE_MARKING )
+  {
+    finish_marking();
+  }
+  if( phase == PHASE_SWEEPING )
+  {
+    sweep_step( SIZE_MAX );
+  }
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+
+void minor()
+{
+#ifdef __linux__
+  Pause pause;
+  minor_mode = true;
+
+  trace_roots();
+
+  for( Garbage * obj : remembered )
+  {
+    trace( obj );
+  }
+
+  // whatever the running full collection has marked must survive it
+  if( phase == PHASE_MARKING )
+  {
+    for( Space * space : spaces )
+    {
+      space->mark_nursery();
+    }
+  }
+
+  mark_stack();
+  drain( minor_gray );
+
+  for( Space * space : spaces )
+  {
+    space->sweep_nursery();
+  }
+
+  // every young survivor is old now, so nothing old points to a young object
+  forget_remembered();
+
+  minor_mode = false;
+  stats.minor_collections++;
+
+  if( phase == PHASE_IDLE && stats.old_size >= stats.threshold )
+  {
+    begin_cycle();
+    if( gc_mode == STOP_THE_WORLD )
+    {
+      finish_cycle();
+    }
+  }
 #endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void step()
+{
+#ifdef __linux__
+  Pause pause;
+  stats.steps++;
+
+  if( phase == PHASE_MARKING )
+  {
+    if( drain( gray, step_budget ) )
+    {
+      finish_marking();
+    }
+  }
+  else if( phase == PHASE_SWEEPING )
+  {
+    // sweeping a page costs about as much as tracing a thousand objects
+    sweep_step( std::max<std::size_t>( 1, step_budget / 1024 ) );
+  }
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void run()
+{
+#ifdef __linux__
+  Pause pause;
+
+  // finish what was started, then collect everything that is garbage now
+  finish_cycle();
+  begin_cycle();
+  finish_cycle();
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void delete_all()
+{
+  // the remembered objects are about to be freed
+  remembered.clear();
+  for( Space * space : spaces )
+  {
+    space->release_all();
+  }
+  gray.clear();
+  minor_gray.clear();
+  phase          = PHASE_IDLE;
+  stats.old_size = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void add_static( Garbage * obj )
+{
+  // these flags keep the object off the gray stacks and out of the
+  // remembered set
+  obj->set_marked( true );
+  obj->set_old( true );
+  obj->set_remembered( true );
+}
+
+void add_root( Garbage * root, Space::Trace trace )
+{
+  // roots are not on the heap and are traced explicitly by every collection
+  add_static( root );
+  roots.push_back( Root{ root, trace } );
+}
+
+void remove_root( Garbage * root )
+{
+  auto it = std::remove_if( roots.begin(), roots.end(), [root]( const Root & r ) { return r.obj == root; } );
+  roots.erase( it, roots.end() );
+}
+
+bool has_roots()
+{
+  return !roots.empty();
+}
+
+void set_threshold( std::size_t threshold )
+{
+  min_threshold   = threshold;
+  stats.threshold = threshold;
+}
+
+void set_heap_limit( std::size_t bytes )
+{
+  heap_limit = bytes;
+}
+
+void set_mode( Mode m )
+{
+  gc_mode = m;
+}
+
+Mode mode()
+{
+  return gc_mode;
+}
+
+void set_step_budget( std::size_t budget )
+{
+  step_budget = std::max<std::size_t>( 1, budget );
+}
 
 } // namespace gc
 
-} // namespace lisp
\ No newline at end of file
+} // namespace lisp
@@ -1,6 +1,10 @@
 #pragma once
 
-#include <list>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
 
 namespace lisp
 {
@@ -10,39 +14,329 @@ namespace lisp
 namespace gc
 {
 
+// common header of all collected objects. it is not polymorphic, objects are
+// traced and destroyed through the Space they were allocated from. every
+// collected type provides a 'void mark()' that visits its references with
+// gc::mark().
 class Garbage
 {
 public:
   Garbage();
-  virtual ~Garbage()
-  {
-  }
-  virtual void mark() = 0;
   bool is_marked() const;
   void set_marked( bool );
 
-  static std::list<Garbage *> heap;
+  // objects that survived a collection are old, everything else is young
+  bool is_old() const
+  {
+    return m_flags & FLAG_OLD;
+  }
+
+  void set_old( bool );
+
+  bool is_remembered() const
+  {
+    return m_flags & FLAG_REMEMBERED;
+  }
+
+  void set_remembered( bool );
+
+  // nursery collections use their own mark bit, so that they can run while
+  // an incremental full collection is marking the heap
+  bool is_minor_marked() const
+  {
+    return m_flags & FLAG_MINOR_MARKED;
+  }
+
+  void set_minor_marked( bool );
 
 protected:
-  bool m_marked;
+  enum : std::uint8_t
+  {
+    FLAG_MARKED       = 1 << 0,
+    FLAG_OLD          = 1 << 1,
+    FLAG_REMEMBERED   = 1 << 2,
+    FLAG_MINOR_MARKED = 1 << 3,
+  };
+
+  std::uint8_t m_flags;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+constexpr std::size_t PAGE_SIZE = 64 * 1024;
+
+// number of pages per space that new objects are allocated from
+constexpr std::size_t NURSERY_PAGES = 16;
+
+// objects traced by one incremental step, roughly a millisecond of work
+constexpr std::size_t DEFAULT_STEP_BUDGET = 16 * 1024;
+
+class Space;
+
+// pages are PAGE_SIZE aligned, so the page of any cell is found by masking its
+// address. the header is followed by one 'used' byte per cell, then the cells.
+struct Page
+{
+  Space * space;
+  std::size_t cell_size;
+  std::size_t cell_count;
+  std::size_t live;
+  char * cells;
+  std::uint8_t used[1];
+
+  static Page * of( const void * ptr )
+  {
+    return reinterpret_cast<Page *>( reinterpret_cast<std::uintptr_t>( ptr ) & ~( PAGE_SIZE - 1 ) );
+  }
+
+  std::size_t index_of( const void * ptr ) const
+  {
+    return ( static_cast<const char *>( ptr ) - cells ) / cell_size;
+  }
+
+  void * cell( std::size_t index ) const
+  {
+    return cells + index * cell_size;
+  }
+
+  char * end() const
+  {
+    return cells + cell_count * cell_size;
+  }
+};
+
+// a segregated heap holding the cells of one type in contiguous pages.
+// new objects are bump allocated from the nursery pages, holes left in them
+// by earlier collections are reused through a free list.
+class Space
+{
+public:
+  using Trace   = void ( * )( void * );
+  using Destroy = void ( * )( void * );
+
+  // cells are 'cell_size' rounded up to 'align', free cells hold a pointer
+  Space( std::size_t cell_size, std::size_t align, Trace trace, Destroy destroy );
+
+  void trace( void * cell ) const
+  {
+    m_trace( cell );
+  }
+
+  void * allocate()
+  {
+    char * cell;
+    if( m_bump < m_limit )
+    {
+      cell = m_bump;
+      m_bump += m_cell_size;
+    }
+    else if( m_free != nullptr )
+    {
+      cell   = reinterpret_cast<char *>( m_free );
+      m_free = m_free->next;
+    }
+    else
+    {
+      return allocate_slow();
+    }
+
+    Page * page                        = Page::of( cell );
+    page->used[page->index_of( cell )] = 1;
+    page->live++;
+    return cell;
+  }
+
+  // free unmarked young objects and promote the survivors
+  void sweep_nursery();
+
+  // free all unmarked objects
+  void sweep();
+
+  // free all unmarked objects in the nursery and queue the old pages
+  void begin_sweep();
+
+  // sweep at most 'budget' queued pages, returns true when done
+  bool sweep_step( std::size_t budget );
+
+  // treat young objects marked by the running full collection as roots
+  void mark_nursery();
+
+  void release_all();
+
+private:
+  struct FreeCell
+  {
+    FreeCell * next;
+  };
+
+  std::size_t m_cell_size;
+  Trace m_trace;
+  Destroy m_destroy;
+  std::vector<Page *> m_nursery;
+  std::vector<Page *> m_old;
+  std::vector<Page *> m_sweep_queue;
+  std::size_t m_next_page;
+  char * m_bump;
+  char * m_limit;
+  FreeCell * m_free;
+
+  void * allocate_slow();
+  bool next_nursery_page();
+  Page * new_page();
+  void free_page( Page * );
+  void reset_nursery();
+  bool sweep_page( Page *, bool young );
+};
+
+template <typename T>
+void trace( void * cell )
+{
+  static_cast<T *>( cell )->mark();
+}
+
+template <typename T>
+void destroy( void * cell )
+{
+  static_cast<T *>( cell )->~T();
+}
+
+template <typename T>
+Space & space()
+{
+  static Space s( sizeof( T ), alignof( T ), trace<T>, destroy<T> );
+  return s;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+struct Stats
+{
+  std::size_t heap_size;         // objects currently on the heap
+  std::size_t peak_size;         // largest heap size seen so far
+  std::size_t old_size;          // objects that survived a collection
+  std::size_t allocations;       // objects allocated in total
+  std::size_t threshold;         // old objects that trigger the next full collection
+  std::size_t collections;       // number of full collections
+  std::size_t minor_collections; // number of nursery collections
+  std::size_t steps;             // number of incremental steps
+  std::size_t promoted;          // objects promoted out of the nursery in total
+  std::size_t freed;             // objects freed in total
+  std::size_t pages;             // pages currently owned by the heap
+  std::size_t max_pause_ns;      // longest time spent in the collector at once
+  std::size_t total_pause_ns;    // total time spent in the collector
+};
+
+extern Stats stats;
+
+enum Mode
+{
+  // full collections run to completion as soon as they are triggered
+  STOP_THE_WORLD,
+  // full collections are spread over many small steps
+  INCREMENTAL,
+};
+
+enum Phase
+{
+  PHASE_IDLE,
+  PHASE_MARKING,
+  PHASE_SWEEPING,
 };
 
+extern Phase phase;
+
+void set_mode( Mode );
+
+Mode mode();
+
+// number of objects traced (or pages swept) by one incremental step
+void set_step_budget( std::size_t );
+
+// mark everything reachable from the roots and free the rest
+void run();
+
+// collect only the young objects
+void minor();
+
+// advance an incremental full collection, if one is running
+void step();
+
 template <typename T, typename... Args>
 T * alloc( Args &&... args )
 {
-  T * obj = new T( std::forward<Args>( args )... );
-  Garbage::heap.push_back( obj );
+  T * obj = new( space<T>().allocate() ) T( std::forward<Args>( args )... );
+
+  stats.allocations++;
+  if( ++stats.heap_size > stats.peak_size )
+  {
+    stats.peak_size = stats.heap_size;
+  }
   return obj;
 }
 
 void mark( Garbage * );
 
-void sweep();
+void remember( Garbage * );
 
-void run();
+void shade( Garbage * );
+
+// must be called whenever a reference to 'value' is stored into 'owner' after
+// 'owner' was constructed, so that nursery collections can find it and an
+// incremental collection never sees a marked object point to an unmarked one
+inline void write_barrier( Garbage * owner, Garbage * value )
+{
+  if( value == nullptr )
+  {
+    return;
+  }
+
+  if( owner->is_old() && !value->is_old() && !owner->is_remembered() )
+  {
+    remember( owner );
+  }
+
+  if( phase == PHASE_MARKING && owner->is_marked() && !value->is_marked() )
+  {
+    shade( value );
+  }
+}
+
+void sweep();
 
 void delete_all();
 
+// objects that live outside the heap and reference nothing on it, they are
+// never traced and never collected
+void add_static( Garbage * );
+
+// objects that live outside the heap but reference it (e.g. the root context)
+void add_root( Garbage *, Space::Trace );
+
+template <typename T>
+void add_root( T * root )
+{
+  add_root( root, trace<T> );
+}
+
+void remove_root( Garbage * );
+
+bool has_roots();
+
+// calls 'fn' with 'arg' while the stack of this thread is scanned by the
+// collections of other threads, for running the evaluator on a thread that
+// this one waits for
+void park_stack( void ( *fn )( void * ), void * arg );
+
+void set_threshold( std::size_t );
+
+// thrown by alloc() when the heap would have to grow beyond the heap limit
+struct HeapLimitExceeded
+{
+};
+
+// the bytes of pages the heap may own, 0 for no limit
+void set_heap_limit( std::size_t );
+
 } // namespace gc
 
-} // namespace lisp
\ No newline at end of file
+} // namespace lisp
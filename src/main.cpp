@@ -1,8 +1,12 @@
 #include "argparser.h"
 #include "eval.h"
+#include "gc.h"
 #include "lisp.h"
 #include "version.h"
 
+#include <charconv>
+#include <cstdint>
+
 int compile_and_print( const std::string & program )
 {
   lisp::Expr * p = lisp::parse( program );
@@ -21,19 +25,35 @@ int compile_and_print( const std::string & program )
   return 0;
 }
 
+// true if 'text' is a positive integer no larger than 'max'
+static bool parse_count( const std::string & text, std::size_t max, std::size_t & value )
+{
+  const char * end = text.data() + text.size();
+  auto [ptr, ec]   = std::from_chars( text.data(), end, value );
+  return ec == std::errc() && ptr == end && value > 0 && value <= max;
+}
+
 int main( int argc, char ** argv )
 {
   ArgParser args;
   args.add_argument( "filename" );
   args.add_argument( "json", true, false );
+  args.add_argument( "dump-optimized", true, false );
   args.add_argument( "version", true, false );
   args.add_argument( "help", true, false );
+  args.add_argument( "gc", false, false, "incremental" );
+  args.add_argument( "gc-step", false, false );
+  args.add_argument( "engine", false, false, "closure" );
+  args.add_argument( "stack", false, false );
 
   args.parse_args( argc, argv );
 
   bool print_json;
   args.get_argument( "json", print_json );
 
+  bool dump_optimized;
+  args.get_argument( "dump-optimized", dump_optimized );
+
   bool print_help = false;
   if( args.get_argument( "help", print_help ) && print_help )
   {
@@ -48,6 +68,67 @@ int main( int argc, char ** argv )
     return 0;
   }
 
+  std::string gc_mode;
+  args.get_argument( "gc", gc_mode );
+  if( gc_mode == "incremental" )
+  {
+    lisp::gc::set_mode( lisp::gc::INCREMENTAL );
+  }
+  else if( gc_mode == "stop-the-world" )
+  {
+    lisp::gc::set_mode( lisp::gc::STOP_THE_WORLD );
+  }
+  else
+  {
+    std::cerr << "'--gc' expects 'incremental' or 'stop-the-world'" << std::endl;
+    return 1;
+  }
+
+  std::string gc_step;
+  if( args.get_argument( "gc-step", gc_step ) && !gc_step.empty() )
+  {
+    std::size_t step;
+    if( !parse_count( gc_step, SIZE_MAX, step ) )
+    {
+      std::cerr << "'--gc-step' expects a positive number of objects" << std::endl;
+      return 1;
+    }
+    lisp::gc::set_step_budget( step );
+  }
+
+  std::string engine;
+  args.get_argument( "engine", engine );
+  if( engine == "closure" )
+  {
+    lisp::set_engine( lisp::ENGINE_CLOSURE );
+  }
+  else if( engine == "tree" )
+  {
+    lisp::set_engine( lisp::ENGINE_TREE );
+  }
+  else if( engine == "vm" )
+  {
+    lisp::set_engine( lisp::ENGINE_VM );
+  }
+  else
+  {
+    std::cerr << "'--engine' expects 'closure', 'tree' or 'vm'" << std::endl;
+    return 1;
+  }
+
+  // the stack budget in megabytes
+  std::string stack;
+  if( args.get_argument( "stack", stack ) && !stack.empty() )
+  {
+    std::size_t megabytes;
+    if( !parse_count( stack, SIZE_MAX >> 20, megabytes ) )
+    {
+      std::cerr << "'--stack' expects a positive number of megabytes" << std::endl;
+      return 1;
+    }
+    lisp::set_stack_budget( megabytes << 20 );
+  }
+
   std::string filename;
   args.get_argument( "filename", filename );
 
@@ -57,6 +138,12 @@ int main( int argc, char ** argv )
     return 1;
   }
 
+  if( dump_optimized && filename.empty() )
+  {
+    std::cerr << "'--dump-optimized' expects a filename to be set" << std::endl;
+    return 1;
+  }
+
   if( !filename.empty() )
   {
     std::ifstream file( filename );
@@ -75,6 +162,11 @@ int main( int argc, char ** argv )
       return compile_and_print( program );
     }
 
+    if( dump_optimized )
+    {
+      return lisp::eval( program, lisp::FLAG_INIT | lisp::FLAG_DUMP_OPTIMIZED );
+    }
+
     return lisp::eval( program, lisp::FLAG_INIT );
   }
   else
@@ -0,0 +1,308 @@
+#pragma once
+
+#include "builtin.h"
+#include "eval.h"
+#include "expr.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace lisp
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// typed natives
+//
+// a native is a plain C++ function such as
+//
+//   std::int64_t f_strlen( std::string_view s );
+//
+// registered with defnative<"strlen", builtin::f_strlen>( context ). the
+// number and the types of the arguments are checked before the call, then
+// they are converted and the function is called directly. a parameter of
+// type Args takes the remaining arguments. Context & and const IO & are
+// passed through and do not count as arguments.
+
+// the name of a native as a template argument
+template <std::size_t N>
+struct NativeName
+{
+  constexpr NativeName( const char ( &name )[N] )
+  {
+    std::copy_n( name, N, value );
+  }
+
+  char value[N];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+// how an argument is checked and converted to a parameter of type T
+template <typename T>
+struct NativeParam;
+
+template <>
+struct NativeParam<Expr *>
+{
+  static constexpr const char * expected = "anything";
+
+  static bool check( Expr * )
+  {
+    return true;
+  }
+
+  static Expr * get( Expr * arg )
+  {
+    return arg;
+  }
+};
+
+template <>
+struct NativeParam<bool>
+{
+  static constexpr const char * expected = "anything";
+
+  static bool check( Expr * )
+  {
+    return true;
+  }
+
+  static bool get( Expr * arg )
+  {
+    return arg->is_truthy();
+  }
+};
+
+template <>
+struct NativeParam<std::int64_t>
+{
+  static constexpr const char * expected = "an integer";
+
+  static bool check( Expr * arg )
+  {
+    return arg->is_integer();
+  }
+
+  static std::int64_t get( Expr * arg )
+  {
+    return arg->integer;
+  }
+};
+
+template <>
+struct NativeParam<double>
+{
+  static constexpr const char * expected = "a number";
+
+  static bool check( Expr * arg )
+  {
+    return arg->is_number();
+  }
+
+  static double get( Expr * arg )
+  {
+    return arg->as_number();
+  }
+};
+
+template <>
+struct NativeParam<Number>
+{
+  static constexpr const char * expected = "a number";
+
+  static bool check( Expr * arg )
+  {
+    return arg->is_number();
+  }
+
+  static Number get( Expr * arg )
+  {
+    return Number{ arg };
+  }
+};
+
+template <>
+struct NativeParam<std::string_view>
+{
+  static constexpr const char * expected = "a string";
+
+  static bool check( Expr * arg )
+  {
+    return arg->is_string();
+  }
+
+  static std::string_view get( Expr * arg )
+  {
+    return arg->string->view();
+  }
+};
+
+// strings are always followed by a '\0'
+template <>
+struct NativeParam<const char *>
+{
+  static constexpr const char * expected = "a string";
+
+  static bool check( Expr * arg )
+  {
+    return arg->is_string();
+  }
+
+  static const char * get( Expr * arg )
+  {
+    return arg->string->data();
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+// the value a native returns to lisp
+template <typename R>
+Expr * native_result( R value )
+{
+  if constexpr( std::is_same_v<R, Expr *> )
+  {
+    return value;
+  }
+  else if constexpr( std::is_same_v<R, bool> )
+  {
+    return make_boolean( value );
+  }
+  else if constexpr( std::is_integral_v<R> )
+  {
+    return make_integer( static_cast<std::int64_t>( value ) );
+  }
+  else if constexpr( std::is_floating_point_v<R> )
+  {
+    return make_real( value );
+  }
+  else
+  {
+    std::string_view string = value;
+    return make_string( string.data(), string.size() );
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+template <NativeName Name, auto Fn, std::uint32_t Flags, typename F = decltype( Fn )>
+struct NativeBinding;
+
+template <NativeName Name, auto Fn, std::uint32_t Flags, typename R, typename... Ps>
+struct NativeBinding<Name, Fn, Flags, R ( * )( Ps... )>
+{
+  template <typename P>
+  static constexpr bool is_rest = std::is_same_v<P, Args>;
+
+  template <typename P>
+  static constexpr bool is_passed = std::is_same_v<P, Context &> || std::is_same_v<P, const IO &>;
+
+  // arguments come first, then the rest, then what is passed through, so
+  // that the i-th parameter takes the i-th argument
+  template <typename P>
+  static constexpr int rank = is_passed<P> ? 2 : ( is_rest<P> ? 1 : 0 );
+
+  static constexpr bool in_order()
+  {
+    int ranks[] = { rank<Ps>..., 2 };
+    return std::is_sorted( std::begin( ranks ), std::end( ranks ) );
+  }
+
+  static_assert( in_order(), "the rest and the passed parameters of a native have to come last" );
+
+  static constexpr std::uint32_t min_args = ( ( rank<Ps> == 0 ? 1u : 0u ) + ... + 0u );
+  static constexpr std::uint32_t max_args = ( is_rest<Ps> || ... ) ? VARIADIC : min_args;
+
+  struct Check
+  {
+    bool ( *fn )( Expr * );
+    const char * expected;
+  };
+
+  template <typename P>
+  static constexpr Check check_of()
+  {
+    if constexpr( rank<P> == 0 )
+    {
+      return Check{ &NativeParam<P>::check, NativeParam<P>::expected };
+    }
+    else
+    {
+      return Check{ nullptr, nullptr };
+    }
+  }
+
+  template <typename P>
+  static P get( Args args, std::size_t i, Context & context, const IO & io )
+  {
+    if constexpr( std::is_same_v<P, Context &> )
+    {
+      return context;
+    }
+    else if constexpr( std::is_same_v<P, const IO &> )
+    {
+      return io;
+    }
+    else if constexpr( is_rest<P> )
+    {
+      return Args{ args.data + i, args.size - i };
+    }
+    else
+    {
+      return NativeParam<P>::get( args[i] );
+    }
+  }
+
+  template <std::size_t... Is>
+  static Expr * invoke( Args args, Context & context, const IO & io, std::index_sequence<Is...> )
+  {
+    if constexpr( std::is_void_v<R> )
+    {
+      Fn( get<Ps>( args, Is, context, io )... );
+      return make_void();
+    }
+    else
+    {
+      return native_result<R>( Fn( get<Ps>( args, Is, context, io )... ) );
+    }
+  }
+
+  // the number of arguments has been checked by call_native()
+  static Expr * call( Args args, Context & context, const IO & io )
+  {
+    static constexpr Check checks[] = { check_of<Ps>()..., Check{ nullptr, nullptr } };
+    for( std::size_t i = 0; i < min_args; i++ )
+    {
+      if( !checks[i].fn( args[i] ) )
+      {
+        return type_error( Name.value, i, checks[i].expected, args[i] );
+      }
+    }
+    return invoke( args, context, io, std::index_sequence_for<Ps...>() );
+  }
+
+  static constexpr NativeDef def = { Name.value, min_args, max_args, &call, Flags };
+};
+
+// the native 'Fn', every call of it shares one definition. 'Flags' are the
+// NATIVE_* flags of builtin.h
+template <NativeName Name, auto Fn, std::uint32_t Flags = 0>
+Expr * make_native()
+{
+  return make_native( &NativeBinding<Name, Fn, Flags>::def );
+}
+
+template <NativeName Name, auto Fn, std::uint32_t Flags = 0>
+void defnative( Context & context )
+{
+  context.defvar( Name.value, make_native<Name, Fn, Flags>() );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+} // namespace lisp
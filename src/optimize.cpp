@@ -0,0 +1,380 @@
+#include "optimize.h"
+#include "tokenizer.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace lisp
+{
+
+///////////////////////////////////////////////////////////////////////////////
+
+// the names a form binds somewhere, they may shadow a native
+using Bound = std::vector<Expr *>;
+
+static void collect_bound( Expr * expr, Bound & bound )
+{
+  if( !expr->is_cons() || expr->car()->is_symbol( SYM_QUOTE ) )
+  {
+    return;
+  }
+
+  Expr * args = expr->cdr();
+  switch( expr->car()->id )
+  {
+    case SYM_DEFINE :
+      if( args->is_cons() && args->car()->is_symbol() )
+      {
+        bound.push_back( args->car() );
+      }
+      break;
+    case SYM_LAMBDA :
+    case SYM_MACRO :
+      for( Expr * it = args->is_cons() ? args->car() : args; it->is_cons(); it = it->cdr() )
+      {
+        bound.push_back( it->car() );
+      }
+      break;
+    case SYM_LET :
+      for( Expr * it = args->is_cons() ? args->car() : args; it->is_cons(); it = it->cdr() )
+      {
+        if( it->car()->is_cons() )
+        {
+          bound.push_back( it->car()->car() );
+        }
+      }
+      break;
+    case SYM_DOTIMES :
+    case SYM_DOLIST :
+      if( args->is_cons() && args->car()->is_cons() )
+      {
+        bound.push_back( args->car()->car() );
+      }
+      break;
+    default :
+      break;
+  }
+
+  for( Expr * it = expr; it->is_cons(); it = it->cdr() )
+  {
+    collect_bound( it->car(), bound );
+  }
+}
+
+static bool is_bound( const Bound & bound, Expr * symbol )
+{
+  return std::find( bound.begin(), bound.end(), symbol ) != bound.end();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// the value of 'expr' if it is a literal or a quoted atom, nullptr otherwise
+static Expr * constant_value( Expr * expr )
+{
+  if( expr->is_atom() && !expr->is_symbol() )
+  {
+    return expr;
+  }
+
+  if( expr->is_cons() && expr->car()->is_symbol( SYM_QUOTE ) && expr->cdr()->is_cons() &&
+      expr->cdr()->car()->is_atom() )
+  {
+    return expr->cdr()->car();
+  }
+  return nullptr;
+}
+
+// only values that are written the same way they print are folded
+static bool is_foldable( Expr * value )
+{
+  switch( value->type )
+  {
+    case Expr::EXPR_NIL :
+    case Expr::EXPR_BOOLEAN :
+    case Expr::EXPR_REAL :
+    case Expr::EXPR_INTEGER :
+    case Expr::EXPR_BIGNUM :
+    case Expr::EXPR_SYMBOL :
+    case Expr::EXPR_STRING :
+      return true;
+    default :
+      return false;
+  }
+}
+
+static Expr * constant_form( Expr * value )
+{
+  return value->is_symbol() ? make_list( make_symbol( KW_QUOTE ), value ) : value;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static Expr * optimize( Expr * expr, Context & context, const IO & io, const Bound & bound );
+
+// optimizes every element of 'list', which is returned if none changed
+static Expr * optimize_all( Expr * list, Context & context, const IO & io, const Bound & bound )
+{
+  ListBuilder builder;
+  bool changed = false;
+  Expr * it    = list;
+  for( ; it->is_cons(); it = it->cdr() )
+  {
+    Expr * element = optimize( it->car(), context, io, bound );
+    changed        = changed || ( element != it->car() );
+    builder.append( element );
+  }
+
+  if( !changed || !it->is_nil() )
+  {
+    return list;
+  }
+  return builder.list();
+}
+
+// calls the pure native 'fn' if all arguments are constants
+static Expr * fold( Expr * expr, Expr * fn, Context & context, const IO & io )
+{
+  std::size_t argc = 0;
+  for( Expr * it = expr->cdr(); it->is_cons(); it = it->cdr(), argc++ )
+  {
+    if( constant_value( it->car() ) == nullptr )
+    {
+      return expr;
+    }
+  }
+
+  Expr ** values = push_arguments( argc );
+  Expr * it      = expr->cdr();
+  for( std::size_t i = 0; i < argc; i++, it = it->cdr() )
+  {
+    values[i] = constant_value( it->car() );
+  }
+  Expr * result = call_native( fn, Args{ values, argc }, context, io );
+  pop_arguments( values );
+
+  // errors are left to happen when the form is evaluated
+  return is_foldable( result ) ? constant_form( result ) : expr;
+}
+
+static Expr * optimize_if( Expr * expr, Context & context, const IO & io, const Bound & bound )
+{
+  Expr * args = expr->cdr();
+  if( !args->is_cons() || !args->cdr()->is_cons() || !args->cdr()->cdr()->is_cons() )
+  {
+    return expr;
+  }
+
+  Expr * test  = optimize( args->car(), context, io, bound );
+  Expr * value = constant_value( test );
+  if( value != nullptr )
+  {
+    Expr * branch = value->is_truthy() ? args->cdr()->car() : args->cdr()->cdr()->car();
+    return optimize( branch, context, io, bound );
+  }
+
+  Expr * branches = optimize_all( args->cdr(), context, io, bound );
+  if( test == args->car() && branches == args->cdr() )
+  {
+    return expr;
+  }
+  return make_cons( expr->car(), make_cons( test, branches ) );
+}
+
+static Expr * optimize_cond( Expr * expr, Context & context, const IO & io, const Bound & bound )
+{
+  for( Expr * it = expr->cdr(); it->is_cons(); it = it->cdr() )
+  {
+    if( !it->car()->is_cons() )
+    {
+      return expr;
+    }
+  }
+
+  // clauses whose test is constantly false are dropped, a constantly true
+  // test ends the cond
+  ListBuilder clauses;
+  for( Expr * it = expr->cdr(); it->is_cons(); it = it->cdr() )
+  {
+    Expr * test  = optimize( it->car()->car(), context, io, bound );
+    Expr * body  = optimize_all( it->car()->cdr(), context, io, bound );
+    Expr * value = constant_value( test );
+    if( value != nullptr && !value->is_truthy() )
+    {
+      continue;
+    }
+
+    if( value != nullptr && clauses.list() == nullptr )
+    {
+      // the forms of the clause are evaluated in order
+      if( !body->is_cons() )
+      {
+        return make_nil();
+      }
+      return body->cdr()->is_cons() ? make_cons( make_symbol( KW_PROGN ), body ) : body->car();
+    }
+
+    clauses.append( make_cons( test, body ) );
+    if( value != nullptr )
+    {
+      break;
+    }
+  }
+
+  Expr * rest = ( clauses.list() != nullptr ) ? clauses.list() : make_nil();
+  return make_cons( expr->car(), rest );
+}
+
+// and and or stop at the first operand that decides them, 'decides' is the
+// truth value that does. the deciding or the last operand is their value
+static Expr * optimize_logic( Expr * expr, bool decides, Context & context, const IO & io, const Bound & bound )
+{
+  ListBuilder operands;
+  std::size_t count = 0;
+  for( Expr * it = expr->cdr(); it->is_cons(); it = it->cdr() )
+  {
+    Expr * operand = optimize( it->car(), context, io, bound );
+    Expr * value   = constant_value( operand );
+    if( value != nullptr && value->is_truthy() != decides && it->cdr()->is_cons() )
+    {
+      continue;
+    }
+
+    operands.append( operand );
+    count++;
+    if( value != nullptr )
+    {
+      break;
+    }
+  }
+
+  if( count == 0 )
+  {
+    return make_boolean( !decides );
+  }
+  if( count == 1 )
+  {
+    return operands.list()->car();
+  }
+  return make_cons( expr->car(), operands.list() );
+}
+
+static Expr * optimize_let( Expr * expr, Context & context, const IO & io, const Bound & bound )
+{
+  Expr * args = expr->cdr();
+  if( !args->is_cons() || !args->cdr()->is_cons() )
+  {
+    return expr;
+  }
+
+  ListBuilder bindings;
+  Expr * it = args->car();
+  for( ; it->is_cons(); it = it->cdr() )
+  {
+    Expr * binding = it->car();
+    if( !binding->is_cons() || !binding->cdr()->is_cons() )
+    {
+      return expr;
+    }
+    Expr * value = optimize( binding->cdr()->car(), context, io, bound );
+    bindings.append( make_cons( binding->car(), make_cons( value, binding->cdr()->cdr() ) ) );
+  }
+
+  if( !it->is_nil() || bindings.list() == nullptr )
+  {
+    return expr;
+  }
+
+  Expr * body = optimize_all( args->cdr(), context, io, bound );
+  return make_cons( expr->car(), make_cons( bindings.list(), body ) );
+}
+
+static Expr * optimize_call( Expr * expr, Context & context, const IO & io, const Bound & bound )
+{
+  Expr * op = expr->car();
+  Expr * fn = nullptr;
+  if( op->is_symbol() && !is_bound( bound, op ) )
+  {
+    // the arguments of macros are not evaluated, and an unknown operator may
+    // become one
+    fn = context.lookup( op );
+    if( !fn->is_procedure() || fn->is_macro() )
+    {
+      return expr;
+    }
+  }
+
+  expr = optimize_all( expr, context, io, bound );
+  if( fn != nullptr && fn->is_native() && ( fn->native->flags & NATIVE_PURE ) )
+  {
+    return fold( expr, fn, context, io );
+  }
+  return expr;
+}
+
+static Expr * optimize( Expr * expr, Context & context, const IO & io, const Bound & bound )
+{
+  if( !expr->is_cons() )
+  {
+    return expr;
+  }
+
+  Expr * args = expr->cdr();
+  switch( expr->car()->id )
+  {
+    // lambda bodies run later, when the natives they call may have been
+    // rebound
+    case SYM_QUOTE :
+    case SYM_QUASIQUOTE :
+    case SYM_UNQUOTE :
+    case SYM_UNQUOTE_SPLICE :
+    case SYM_MACRO :
+    case SYM_LAMBDA :
+    case SYM_TO_STREAM :
+    case SYM_FROM_STREAM :
+    case SYM_PIPE :
+      return expr;
+    case SYM_DEFINE :
+    case SYM_DOTIMES :
+    case SYM_DOLIST :
+      {
+        // the name or the loop head stay as they are
+        if( !args->is_cons() )
+        {
+          return expr;
+        }
+        Expr * rest = optimize_all( args->cdr(), context, io, bound );
+        return ( rest == args->cdr() ) ? expr : make_cons( expr->car(), make_cons( args->car(), rest ) );
+      }
+    case SYM_PROGN :
+    case SYM_WHILE :
+      {
+        Expr * rest = optimize_all( args, context, io, bound );
+        return ( rest == args ) ? expr : make_cons( expr->car(), rest );
+      }
+    case SYM_IF :
+      return optimize_if( expr, context, io, bound );
+    case SYM_COND :
+      return optimize_cond( expr, context, io, bound );
+    case SYM_AND :
+      return optimize_logic( expr, false, context, io, bound );
+    case SYM_OR :
+      return optimize_logic( expr, true, context, io, bound );
+    case SYM_LET :
+      return optimize_let( expr, context, io, bound );
+    default :
+      return optimize_call( expr, context, io, bound );
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+Expr * optimize( Expr * expr, Context & context, const IO & io )
+{
+  Bound bound;
+  collect_bound( expr, bound );
+  return optimize( expr, context, io, bound );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+} // namespace lisp
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "eval.h"
+#include "expr.h"
+
+namespace lisp
+{
+
+///////////////////////////////////////////////////////////////////////////////
+
+// rewrites a form before it is evaluated in 'context'. calls of pure natives
+// whose arguments are constants are replaced by their result, and the
+// branches of if, cond, and and or that a constant test rules out are
+// dropped. the bodies of lambdas and macros are left alone, they may run
+// after a native has been rebound. the form itself is never modified.
+Expr * optimize( Expr * expr, Context & context, const IO & io );
+
+///////////////////////////////////////////////////////////////////////////////
+
+} // namespace lisp
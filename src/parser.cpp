@@ -1,6 +1,11 @@
 #include "parser.h"
 #include "expr.h"
 
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+
 namespace lisp
 {
 
@@ -19,6 +24,15 @@ Expr * parse( const std::string & source )
   return program;
 }
 
+// the keywords parse_expr() reads a whole form for
+static bool is_special_form( const Token & token )
+{
+  return token.is_symbol( KW_DEFUN ) || token.is_symbol( KW_DEFMACRO ) || token.is_symbol( KW_DEFINE ) ||
+         token.is_symbol( KW_LAMBDA );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
 Parser::Parser( const Tokens & tokens )
     : m_tokens( tokens )
     , m_current( m_tokens.begin() )
@@ -71,6 +85,26 @@ Expr * Parser::parse_expr()
       {
         advance();
         m_parenthesis_depth++;
+        if( is_special_form( peek() ) )
+        {
+          // the form is read from its keyword on, so it is the list itself
+          // and not the first element of one
+          Expr * form = parse_expr();
+          if( form->is_error() )
+            return form;
+
+          if( match( TokenType::RPAREN ) )
+          {
+            m_parenthesis_depth--;
+            return form;
+          }
+
+          Expr * tail = parse_list();
+          if( tail->is_error() )
+            return tail;
+
+          return make_cons( form, tail );
+        }
         return parse_list();
       }
     case TokenType ::RPAREN :
@@ -97,8 +131,21 @@ Expr * Parser::parse_expr()
         }
         else
         {
-          int num = std::stoi( tkn.lexeme.c_str() );
-          return make_integer( num );
+          // literals too large for an integer are read as bignums
+          const char * first = tkn.lexeme.data();
+          const char * last  = first + tkn.lexeme.size();
+          std::int64_t num   = 0;
+          if( std::from_chars( first, last, num ).ec == std::errc() )
+          {
+            return make_integer( num );
+          }
+
+          Bignum big;
+          if( !Bignum::parse( tkn.lexeme, big ) )
+          {
+            return make_error( "invalid-number" );
+          }
+          return make_bignum( std::move( big ) );
         }
       }
     case TokenType ::STRING :
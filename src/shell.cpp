@@ -1,6 +1,7 @@
 #include "shell.h"
 #include "eval.h"
 #include "expr.h"
+#include "native.h"
 #include "tokenizer.h"
 #include <cstddef>
 #include <cstdio>
@@ -15,7 +16,7 @@ namespace lisp
 namespace shell
 {
 
-Expr * f_exec( Expr * arg, Context & context, const IO & io )
+Expr * f_exec( Args args, const IO & io )
 {
   pid_t pid;
   int status = -1;
@@ -30,9 +31,8 @@ Expr * f_exec( Expr * arg, Context & context, const IO & io )
   if( pid == 0 )
   {
     std::vector<char *> argv;
-    for( Expr * it = arg; it->is_cons(); it = it->cdr() )
+    for( Expr * el : args )
     {
-      Expr * el  = it->car();
       Expr * str = el->is_string() ? el : cast_to_string( el );
       argv.push_back( const_cast<char *>( str->as_string() ) );
     }
@@ -76,20 +76,16 @@ Expr * f_exec( Expr * arg, Context & context, const IO & io )
   return make_boolean( status == 0 );
 }
 
-Expr * f_getenv( Expr * args, Context & context, const IO & io )
+Expr * f_getenv( const char * name )
 {
-  Expr * arg_1 = args->car();
-  if( !arg_1->is_string() )
-    return make_error( "getenv expects a string argument" );
-
-  const char * env = getenv( arg_1->as_string() );
+  const char * env = getenv( name );
   return make_string( env );
 }
 
 void load( Context & ctx )
 {
-  ctx.defvar( "exec", make_native( shell::f_exec ) );
-  ctx.defvar( "getenv", make_native( shell::f_getenv ) );
+  defnative<"exec", f_exec>( ctx );
+  defnative<"getenv", f_getenv>( ctx );
   ctx.defvar( KW_PIPE, make_symbol( KW_PIPE ) );
   ctx.defvar( KW_FROM_STREAM, make_symbol( KW_FROM_STREAM ) );
   ctx.defvar( KW_TO_STREAM, make_symbol( KW_TO_STREAM ) );
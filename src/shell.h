@@ -1,5 +1,6 @@
 #pragma once
 
+#include "builtin.h"
 #include "expr.h"
 
 // how can i manage pipes?
@@ -11,9 +12,9 @@ namespace lisp
 namespace shell
 {
 
-Expr * f_exec( Expr * arg, Context & context, const IO & io );
+Expr * f_exec( Args args, const IO & io );
 
-Expr * f_getenv( Expr * arg, Context & context, const IO & io );
+Expr * f_getenv( const char * name );
 
 void load( Context & ctx );
 
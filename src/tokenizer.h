@@ -26,6 +26,9 @@
 #endif
 #define KW_LET "let"
 #define KW_COND "cond"
+#define KW_WHILE "while"
+#define KW_DOTIMES "dotimes"
+#define KW_DOLIST "dolist"
 #define KW_QUOTE "quote"
 #define KW_QUASIQUOTE "quasiquote"
 #define KW_UNQUOTE "unquote"
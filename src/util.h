@@ -1,7 +1,12 @@
 #pragma once
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <ostream>
+#include <type_traits>
 #ifdef __linux__
 #include <unistd.h>
 #endif
@@ -11,12 +16,22 @@
 namespace lisp
 {
 
+// limits for evaluating a program, a program that runs out of one of them is
+// abandoned with an out-of-steps, out-of-time or out-of-memory error
+struct Budget
+{
+  std::uint64_t steps = 0; // evaluation steps, 0 for no limit
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+  std::size_t heap = 0; // bytes the heap may grow to, 0 for no limit
+};
+
 struct IO
 {
   std::ostream & out;
   std::ostream & err;
   int pipe_stdin;
   int pipe_stdout;
+  Budget budget;
   IO( std::ostream & o = std::cout, std::ostream & e = std::cerr )
       : out( o )
       , err( e )
@@ -27,4 +42,127 @@ struct IO
   {
   }
 };
+
+// a vector that keeps up to N elements inline and only allocates when it
+// grows beyond them. elements are copied bytewise, so T has to be trivially
+// copyable.
+template <typename T, std::size_t N>
+class SmallVector
+{
+  static_assert( std::is_trivially_copyable_v<T> );
+
+public:
+  SmallVector()
+      : m_data( m_inline )
+      , m_size( 0 )
+      , m_capacity( N )
+  {
+  }
+
+  SmallVector( const SmallVector & )             = delete;
+  SmallVector & operator=( const SmallVector & ) = delete;
+
+  SmallVector & operator=( SmallVector && other )
+  {
+    if( this != &other )
+    {
+      release();
+      if( other.m_data == other.m_inline )
+      {
+        std::memcpy( m_inline, other.m_inline, other.m_size * sizeof( T ) );
+        m_data     = m_inline;
+        m_capacity = N;
+      }
+      else
+      {
+        m_data     = other.m_data;
+        m_capacity = other.m_capacity;
+      }
+      m_size           = other.m_size;
+      other.m_data     = other.m_inline;
+      other.m_size     = 0;
+      other.m_capacity = N;
+    }
+    return *this;
+  }
+
+  ~SmallVector()
+  {
+    release();
+  }
+
+  void push_back( const T & value )
+  {
+    if( m_size == m_capacity )
+    {
+      grow();
+    }
+    m_data[m_size++] = value;
+  }
+
+  // keeps the capacity, so that a reused vector does not allocate again
+  void clear()
+  {
+    m_size = 0;
+  }
+
+  std::size_t size() const
+  {
+    return m_size;
+  }
+
+  T & operator[]( std::size_t i )
+  {
+    return m_data[i];
+  }
+
+  const T & operator[]( std::size_t i ) const
+  {
+    return m_data[i];
+  }
+
+  T * begin()
+  {
+    return m_data;
+  }
+
+  T * end()
+  {
+    return m_data + m_size;
+  }
+
+  const T * begin() const
+  {
+    return m_data;
+  }
+
+  const T * end() const
+  {
+    return m_data + m_size;
+  }
+
+private:
+  void grow()
+  {
+    T * data = new T[m_capacity * 2];
+    std::memcpy( data, m_data, m_size * sizeof( T ) );
+    release();
+    m_data     = data;
+    m_capacity = m_capacity * 2;
+  }
+
+  void release()
+  {
+    if( m_data != m_inline )
+    {
+      delete[] m_data;
+    }
+  }
+
+  T m_inline[N];
+  T * m_data;
+  std::size_t m_size;
+  std::size_t m_capacity;
+};
+
 } // namespace lisp
\ No newline at end of file
@@ -0,0 +1,777 @@
+#include "vm.h"
+#include "analyze.h"
+#include "eval.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace lisp
+{
+
+namespace vm
+{
+
+///////////////////////////////////////////////////////////////////////////////
+
+constexpr std::uint32_t NO_CHUNK = UINT32_MAX;
+
+void Chunk::mark()
+{
+  for( Expr * constant : constants )
+  {
+    gc::mark( constant );
+  }
+  for( Chunk * chunk : chunks )
+  {
+    gc::mark( chunk );
+  }
+  for( const Expansion & expansion : expansions )
+  {
+    gc::mark( expansion.macro );
+    gc::mark( expansion.code );
+  }
+}
+
+std::uint32_t Chunk::add_constant( Expr * expr )
+{
+  constants.push_back( expr );
+  gc::write_barrier( this, expr );
+  return static_cast<std::uint32_t>( constants.size() - 1 );
+}
+
+std::uint32_t Chunk::add_chunk( Chunk * chunk )
+{
+  chunks.push_back( chunk );
+  gc::write_barrier( this, chunk );
+  return static_cast<std::uint32_t>( chunks.size() - 1 );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static void emit( Chunk * chunk, Node * node, bool tail );
+
+static std::uint32_t position( Chunk * chunk )
+{
+  return static_cast<std::uint32_t>( chunk->code.size() );
+}
+
+// emits an operation with one operand and returns the position of the operand
+static std::uint32_t emit_op( Chunk * chunk, Op op, std::uint32_t operand )
+{
+  chunk->code.push_back( op );
+  chunk->code.push_back( operand );
+  return position( chunk ) - 1;
+}
+
+static void emit_const( Chunk * chunk, Expr * expr )
+{
+  emit_op( chunk, OP_CONST, chunk->add_constant( expr ) );
+}
+
+// a chunk that evaluates the node and returns its value
+static Chunk * compile_chunk( Node * node, Node * bindings = nullptr )
+{
+  Chunk * chunk = gc::alloc<Chunk>();
+
+  if( bindings != nullptr )
+  {
+    std::size_t i = 0;
+    for( Expr * it = bindings->expr; it->is_cons(); it = it->cdr(), i++ )
+    {
+      emit( chunk, bindings->nodes[i], false );
+      emit_op( chunk, OP_BIND, chunk->add_constant( it->car()->car() ) );
+    }
+  }
+
+  emit( chunk, node, true );
+  chunk->code.push_back( OP_RETURN );
+  return chunk;
+}
+
+// a dotimes or dolist, it runs in a frame that holds the variable
+static Chunk * compile_loop( Node * node )
+{
+  Chunk * chunk     = gc::alloc<Chunk>();
+  std::uint32_t var = chunk->add_constant( node->expr->car() );
+
+  emit( chunk, node->nodes[0], false );
+  if( node->kind == Node::NODE_DOTIMES )
+  {
+    emit_const( chunk, make_integer( 0 ) );
+  }
+
+  std::uint32_t top    = position( chunk );
+  std::uint32_t to_end = emit_op( chunk, node->kind == Node::NODE_DOTIMES ? OP_DOTIMES : OP_DOLIST, 0 );
+  chunk->code.push_back( var );
+  emit( chunk, node->nodes[1], false );
+  chunk->code.push_back( OP_POP );
+  emit_op( chunk, OP_JUMP, top );
+
+  chunk->code[to_end] = position( chunk );
+  chunk->code.push_back( OP_RETURN );
+  return chunk;
+}
+
+// an expression in tail position is always followed by OP_RETURN
+static void emit( Chunk * chunk, Node * node, bool tail )
+{
+  switch( node->kind )
+  {
+    case Node::NODE_CONST :
+      {
+        emit_const( chunk, node->expr );
+        break;
+      }
+    case Node::NODE_REF :
+      {
+        emit_op( chunk, OP_LOOKUP, chunk->add_constant( node->expr ) );
+        break;
+      }
+    case Node::NODE_GLOBAL :
+      {
+        emit_op( chunk, OP_GLOBAL, chunk->add_constant( node->expr ) );
+        chunk->code.push_back( static_cast<std::uint32_t>( chunk->caches.size() ) );
+        chunk->caches.emplace_back();
+        break;
+      }
+    case Node::NODE_LOCAL :
+      {
+        emit_op( chunk, OP_LOCAL, node->depth );
+        chunk->code.push_back( node->slot );
+        chunk->code.push_back( chunk->add_constant( node->expr ) );
+        break;
+      }
+    case Node::NODE_DEFINE :
+      {
+        emit( chunk, node->nodes[0], false );
+        emit_op( chunk, OP_DEFINE, chunk->add_constant( node->expr ) );
+        break;
+      }
+    case Node::NODE_LAMBDA :
+      {
+        std::uint32_t body = NO_CHUNK;
+        if( !node->nodes.empty() )
+        {
+          body = chunk->add_chunk( compile_chunk( node->nodes[0] ) );
+        }
+        emit_op( chunk, OP_LAMBDA, chunk->add_constant( node->expr ) );
+        chunk->code.push_back( body );
+        break;
+      }
+    case Node::NODE_MACRO :
+      {
+        emit_op( chunk, OP_MACRO, chunk->add_constant( node->expr ) );
+        break;
+      }
+    case Node::NODE_IF :
+      {
+        emit( chunk, node->nodes[0], false );
+        std::uint32_t to_else = emit_op( chunk, OP_JUMP_IF_FALSE, 0 );
+
+        emit( chunk, node->nodes[1], tail );
+        std::uint32_t to_end = 0;
+        if( tail )
+        {
+          chunk->code.push_back( OP_RETURN );
+        }
+        else
+        {
+          to_end = emit_op( chunk, OP_JUMP, 0 );
+        }
+
+        chunk->code[to_else] = position( chunk );
+        emit( chunk, node->nodes[2], tail );
+
+        if( !tail )
+        {
+          chunk->code[to_end] = position( chunk );
+        }
+        break;
+      }
+    case Node::NODE_PROGN :
+      {
+        std::size_t last = node->nodes.size() - 1;
+        for( std::size_t i = 0; i < last; i++ )
+        {
+          emit( chunk, node->nodes[i], false );
+          chunk->code.push_back( OP_POP );
+        }
+        emit( chunk, node->nodes[last], tail );
+        break;
+      }
+    case Node::NODE_LET :
+      {
+        Chunk * body = compile_chunk( node->nodes.back(), node );
+        emit_op( chunk, tail ? OP_TAIL_ENTER : OP_ENTER, chunk->add_chunk( body ) );
+        chunk->code.push_back( chunk->add_constant( node->expr ) );
+        break;
+      }
+    case Node::NODE_COND :
+      {
+        std::vector<std::uint32_t> to_end;
+        for( std::size_t i = 0; i < node->nodes.size(); i += 2 )
+        {
+          emit( chunk, node->nodes[i], false );
+          std::uint32_t to_next = emit_op( chunk, OP_JUMP_IF_FALSE, 0 );
+
+          emit( chunk, node->nodes[i + 1], tail );
+          if( tail )
+          {
+            chunk->code.push_back( OP_RETURN );
+          }
+          else
+          {
+            to_end.push_back( emit_op( chunk, OP_JUMP, 0 ) );
+          }
+          chunk->code[to_next] = position( chunk );
+        }
+
+        emit_const( chunk, make_error( "cond expects at least one true condition" ) );
+        for( std::uint32_t operand : to_end )
+        {
+          chunk->code[operand] = position( chunk );
+        }
+        break;
+      }
+    case Node::NODE_OR :
+    case Node::NODE_AND :
+      {
+        // 'or' stops at the first true operand, 'and' at the first false one,
+        // the last operand is in tail position
+        if( node->nodes.empty() )
+        {
+          emit_const( chunk, make_boolean( node->kind == Node::NODE_AND ) );
+          break;
+        }
+
+        std::vector<std::uint32_t> to_end;
+        std::size_t last = node->nodes.size() - 1;
+        for( std::size_t i = 0; i < last; i++ )
+        {
+          emit( chunk, node->nodes[i], false );
+          to_end.push_back( emit_op( chunk, node->kind == Node::NODE_OR ? OP_OR : OP_AND, 0 ) );
+        }
+        emit( chunk, node->nodes[last], tail );
+
+        for( std::uint32_t operand : to_end )
+        {
+          chunk->code[operand] = position( chunk );
+        }
+        break;
+      }
+    case Node::NODE_WHILE :
+      {
+        std::uint32_t top = position( chunk );
+        emit( chunk, node->nodes[0], false );
+        std::uint32_t to_end = emit_op( chunk, OP_JUMP_IF_FALSE, 0 );
+        emit( chunk, node->nodes[1], false );
+        chunk->code.push_back( OP_POP );
+        emit_op( chunk, OP_JUMP, top );
+
+        chunk->code[to_end] = position( chunk );
+        emit_const( chunk, make_nil() );
+        break;
+      }
+    case Node::NODE_DOTIMES :
+    case Node::NODE_DOLIST :
+      {
+        Chunk * body = compile_loop( node );
+        emit_op( chunk, tail ? OP_TAIL_ENTER : OP_ENTER, chunk->add_chunk( body ) );
+        chunk->code.push_back( chunk->add_constant( make_cons( node->expr, make_nil() ) ) );
+        break;
+      }
+    case Node::NODE_CALL :
+      {
+        emit( chunk, node->nodes[0], false );
+
+        std::uint32_t form   = chunk->add_constant( node->expr );
+        std::uint32_t cached = static_cast<std::uint32_t>( chunk->expansions.size() );
+        std::uint32_t to_end = 0;
+        chunk->expansions.emplace_back();
+        if( tail )
+        {
+          emit_op( chunk, OP_TAIL_EXPAND, form );
+          chunk->code.push_back( cached );
+        }
+        else
+        {
+          emit_op( chunk, OP_EXPAND, form );
+          chunk->code.push_back( cached );
+          to_end = position( chunk );
+          chunk->code.push_back( 0 );
+        }
+
+        for( std::size_t i = 1; i < node->nodes.size(); i++ )
+        {
+          emit( chunk, node->nodes[i], false );
+        }
+
+        std::uint32_t argc = static_cast<std::uint32_t>( node->nodes.size() - 1 );
+        emit_op( chunk, tail ? OP_TAIL_CALL : OP_CALL, argc );
+
+        if( !tail )
+        {
+          chunk->code[to_end] = position( chunk );
+        }
+        break;
+      }
+    case Node::NODE_CONS :
+    case Node::NODE_SPLICE :
+      {
+        emit( chunk, node->nodes[0], false );
+        emit( chunk, node->nodes[1], false );
+        chunk->code.push_back( node->kind == Node::NODE_CONS ? OP_CONS : OP_SPLICE );
+        break;
+      }
+    case Node::NODE_FALLBACK :
+      {
+        emit_op( chunk, OP_EVAL, chunk->add_constant( node->expr ) );
+        break;
+      }
+  }
+}
+
+Chunk * compile( Node * node )
+{
+  return compile_chunk( node );
+}
+
+Chunk * lambda_chunk( Expr * fn )
+{
+  Lambda * lambda = fn->lambda;
+  if( lambda->chunk == nullptr )
+  {
+    const Scope * scope = lambda->env->is_root() ? Scope::root() : nullptr;
+    lambda->chunk       = compile( analyze_body( lambda->params, lambda->body->car(), scope ) );
+    gc::write_barrier( fn, lambda->chunk );
+  }
+  return lambda->chunk;
+}
+
+Chunk * macro_chunk( Expr * fn )
+{
+  Macro * macro = fn->macro;
+  if( macro->chunk == nullptr )
+  {
+    macro->chunk = compile( analyze_body( macro->params, macro->body->car() ) );
+    gc::write_barrier( fn, macro->chunk );
+  }
+  return macro->chunk;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+struct Activation
+{
+  Chunk * chunk;
+  const std::uint32_t * ip;
+  Context * context;
+  std::size_t base;   // height of the value stack when the chunk was entered
+  std::size_t frames; // height of the frame stack when the chunk was entered
+};
+
+static std::vector<Expr *> stack;
+static std::vector<Activation> activations;
+
+void reset()
+{
+  stack.clear();
+  activations.clear();
+}
+
+void mark()
+{
+  for( Expr * value : stack )
+  {
+    gc::mark( value );
+  }
+  for( const Activation & activation : activations )
+  {
+    gc::mark( activation.chunk );
+    gc::mark( activation.context );
+  }
+}
+
+#if defined( __GNUC__ ) || defined( __clang__ )
+#define VM_COMPUTED_GOTO
+#endif
+
+#ifdef VM_COMPUTED_GOTO
+#define CASE( op ) L_##op
+#define DISPATCH() goto * labels[*ip++]
+#else
+#define CASE( op ) case op
+#define DISPATCH() goto dispatch
+#endif
+
+Expr * run( Chunk * entry, Context & _context, const IO & io )
+{
+#ifdef VM_COMPUTED_GOTO
+  static void * labels[] = {
+    &&L_OP_CONST,
+    &&L_OP_LOOKUP,
+    &&L_OP_LOCAL,
+    &&L_OP_GLOBAL,
+    &&L_OP_DEFINE,
+    &&L_OP_BIND,
+    &&L_OP_POP,
+    &&L_OP_JUMP,
+    &&L_OP_JUMP_IF_FALSE,
+    &&L_OP_OR,
+    &&L_OP_AND,
+    &&L_OP_LAMBDA,
+    &&L_OP_MACRO,
+    &&L_OP_ENTER,
+    &&L_OP_TAIL_ENTER,
+    &&L_OP_EXPAND,
+    &&L_OP_TAIL_EXPAND,
+    &&L_OP_CALL,
+    &&L_OP_TAIL_CALL,
+    &&L_OP_DOTIMES,
+    &&L_OP_DOLIST,
+    &&L_OP_CONS,
+    &&L_OP_SPLICE,
+    &&L_OP_EVAL,
+    &&L_OP_RETURN,
+  };
+  static_assert( sizeof( labels ) / sizeof( labels[0] ) == OP_COUNT, "every opcode needs a label" );
+#endif
+
+  check_stack();
+
+  // activations do not recurse on the C++ stack, they are held to the stack
+  // budget by what they and their frames take up
+  const std::size_t max_activations = stack_budget() / ( sizeof( Activation ) + sizeof( Context ) );
+
+  const std::size_t bottom = activations.size();
+  activations.push_back( Activation{ entry, entry->code.data(), &_context, stack.size(), frame_height() } );
+
+  Chunk * chunk             = entry;
+  const std::uint32_t * ip  = chunk->code.data();
+  Context * context         = &_context;
+
+  // enters 'next' in 'local' as a new activation, the current one resumes at
+  // 'resume' and drops the frames above 'frames' when 'next' returns
+#define ENTER( next, local, frames, resume )                                                                   \
+  if( activations.size() >= max_activations )                                                                  \
+  {                                                                                                            \
+    abandon( "stack-overflow" );                                                                               \
+  }                                                                                                            \
+  activations.back().ip = ( resume );                                                                          \
+  activations.push_back( Activation{ ( next ), ( next )->code.data(), ( local ), stack.size(), ( frames ) } ); \
+  chunk   = ( next );                                                                                          \
+  ip      = chunk->code.data();                                                                                \
+  context = ( local );
+
+  // replaces the current activation with 'next' in 'local'
+#define REPLACE( next, local )                          \
+  stack.resize( activations.back().base );              \
+  activations.back().chunk   = ( next );                \
+  activations.back().context = ( local );               \
+  chunk                      = ( next );                \
+  ip                         = chunk->code.data();      \
+  context                    = ( local );
+
+  DISPATCH();
+
+#ifndef VM_COMPUTED_GOTO
+dispatch:
+  switch( *ip++ )
+  {
+#endif
+
+  CASE( OP_CONST ) :
+  {
+    stack.push_back( chunk->constants[*ip++] );
+    DISPATCH();
+  }
+  CASE( OP_LOOKUP ) :
+  {
+    stack.push_back( context->lookup( chunk->constants[*ip++] ) );
+    DISPATCH();
+  }
+  CASE( OP_LOCAL ) :
+  {
+    stack.push_back( context->lookup( ip[0], ip[1], chunk->constants[ip[2]] ) );
+    ip += 3;
+    DISPATCH();
+  }
+  CASE( OP_GLOBAL ) :
+  {
+    stack.push_back( context->lookup( chunk->constants[ip[0]], chunk->caches[ip[1]] ) );
+    ip += 2;
+    DISPATCH();
+  }
+  CASE( OP_DEFINE ) :
+  {
+    context->defvar( chunk->constants[*ip++], stack.back() );
+    stack.back() = make_void();
+    DISPATCH();
+  }
+  CASE( OP_BIND ) :
+  {
+    context->defvar( chunk->constants[*ip++], stack.back() );
+    stack.pop_back();
+    DISPATCH();
+  }
+  CASE( OP_POP ) :
+  {
+    stack.pop_back();
+    DISPATCH();
+  }
+  CASE( OP_JUMP ) :
+  {
+    count_step();
+    ip = chunk->code.data() + *ip;
+    DISPATCH();
+  }
+  CASE( OP_JUMP_IF_FALSE ) :
+  {
+    Expr * cond = stack.back();
+    stack.pop_back();
+    ip = cond->is_truthy() ? ip + 1 : chunk->code.data() + *ip;
+    DISPATCH();
+  }
+  CASE( OP_OR ) :
+  CASE( OP_AND ) :
+  {
+    // the operand that decides 'or' or 'and' is its value
+    const bool decides = ( ip[-1] == OP_OR );
+    if( stack.back()->is_truthy() == decides )
+    {
+      ip = chunk->code.data() + *ip;
+    }
+    else
+    {
+      stack.pop_back();
+      ip++;
+    }
+    DISPATCH();
+  }
+  CASE( OP_LAMBDA ) :
+  {
+    Expr * args = chunk->constants[ip[0]];
+    Expr * fn   = make_lambda( args->car(), args->cdr(), context->promote() );
+    if( ip[1] != NO_CHUNK )
+    {
+      fn->lambda->chunk = chunk->chunks[ip[1]];
+      gc::write_barrier( fn, fn->lambda->chunk );
+    }
+    stack.push_back( fn );
+    ip += 2;
+    DISPATCH();
+  }
+  CASE( OP_MACRO ) :
+  {
+    Expr * args = chunk->constants[*ip++];
+    stack.push_back( make_macro( args->car(), args->cdr(), context->promote() ) );
+    DISPATCH();
+  }
+  CASE( OP_ENTER ) :
+  {
+    Chunk * body      = chunk->chunks[ip[0]];
+    std::size_t below = frame_height();
+    Context * local   = push_frame( context );
+    local->declare_bindings( chunk->constants[ip[1]] );
+    ENTER( body, local, below, ip + 2 );
+    DISPATCH();
+  }
+  CASE( OP_TAIL_ENTER ) :
+  {
+    Chunk * body    = chunk->chunks[ip[0]];
+    Context * local = push_frame( context );
+    local->declare_bindings( chunk->constants[ip[1]] );
+    REPLACE( body, local );
+    DISPATCH();
+  }
+  CASE( OP_EXPAND ) :
+  CASE( OP_TAIL_EXPAND ) :
+  {
+    const bool tail = ( ip[-1] == OP_TAIL_EXPAND );
+    Expr * fn       = stack.back();
+    if( !fn->is_macro() )
+    {
+      ip += tail ? 2 : 3;
+      DISPATCH();
+    }
+
+    std::size_t below = frame_height();
+    Context * new_env = push_frame( context );
+    bind_params( new_env, fn->macro->params, chunk->constants[ip[0]]->cdr() );
+
+    // a call site is expanded once, unless its operator changes
+    if( chunk->expansions[ip[1]].macro != fn )
+    {
+      Expr * expansion = run( macro_chunk( fn ), *new_env, io );
+      Chunk * code     = compile( analyze( expansion ) );
+
+      chunk->expansions[ip[1]] = Expansion{ fn, code };
+      gc::write_barrier( chunk, fn );
+      gc::write_barrier( chunk, code );
+    }
+    Chunk * code = chunk->expansions[ip[1]].code;
+    stack.pop_back();
+
+    if( tail )
+    {
+      REPLACE( code, new_env );
+    }
+    else
+    {
+      ENTER( code, new_env, below, chunk->code.data() + ip[2] );
+    }
+    DISPATCH();
+  }
+  CASE( OP_CALL ) :
+  CASE( OP_TAIL_CALL ) :
+  {
+    count_step();
+    const bool tail    = ( ip[-1] == OP_TAIL_CALL );
+    std::size_t argc   = *ip++;
+    std::size_t callee = stack.size() - argc - 1;
+    Expr * fn          = stack[callee];
+
+    if( fn->is_native() )
+    {
+      // natives may run the machine again, which can move the stack
+      Expr ** values = push_arguments( argc );
+      std::copy_n( &stack[callee + 1], argc, values );
+      stack.resize( callee );
+
+      Expr * result = call_native( fn, Args{ values, argc }, *context, io );
+      pop_arguments( values );
+      stack.push_back( result );
+    }
+    else if( fn->is_lambda() )
+    {
+      Chunk * body = lambda_chunk( fn );
+
+      std::size_t below;
+      if( tail )
+      {
+        // the frames of this activation are dead once the call replaces it
+        below = activations.back().frames;
+        pop_frames( below );
+      }
+      else
+      {
+        below = frame_height();
+      }
+
+      Context * new_env;
+      if( fn->lambda->escapes )
+      {
+        new_env = gc::alloc<Context>( fn->lambda->env );
+      }
+      else
+      {
+        new_env = push_frame( fn->lambda->env );
+      }
+      bind_params( new_env, fn->lambda->params, &stack[callee + 1], argc );
+      stack.resize( callee );
+
+      if( tail )
+      {
+        REPLACE( body, new_env );
+      }
+      else
+      {
+        ENTER( body, new_env, below, ip );
+      }
+    }
+    else
+    {
+      stack.resize( callee );
+      stack.push_back( fn );
+    }
+    DISPATCH();
+  }
+  CASE( OP_DOTIMES ) :
+  {
+    Expr * count   = stack[stack.size() - 2];
+    Expr * counter = stack.back();
+    if( count->is_integer() && counter->integer < count->integer )
+    {
+      context->defvar( chunk->constants[ip[1]], counter );
+      stack.back() = make_integer( counter->integer + 1 );
+      ip += 2;
+    }
+    else
+    {
+      stack.pop_back();
+      stack.back() = count->is_integer() ? make_nil() : make_error( "dotimes expects an integer count" );
+      ip           = chunk->code.data() + ip[0];
+    }
+    DISPATCH();
+  }
+  CASE( OP_DOLIST ) :
+  {
+    Expr * list = stack.back();
+    if( list->is_cons() )
+    {
+      context->defvar( chunk->constants[ip[1]], list->car() );
+      stack.back() = list->cdr();
+      ip += 2;
+    }
+    else
+    {
+      stack.back() = make_nil();
+      ip           = chunk->code.data() + ip[0];
+    }
+    DISPATCH();
+  }
+  CASE( OP_CONS ) :
+  {
+    Expr * cdr = stack.back();
+    stack.pop_back();
+    stack.back() = make_cons( stack.back(), cdr );
+    DISPATCH();
+  }
+  CASE( OP_SPLICE ) :
+  {
+    Expr * rest = stack.back();
+    stack.pop_back();
+    stack.back() = splice( stack.back(), rest );
+    DISPATCH();
+  }
+  CASE( OP_EVAL ) :
+  {
+    stack.push_back( eval( chunk->constants[*ip++], *context, io ) );
+    DISPATCH();
+  }
+  CASE( OP_RETURN ) :
+  {
+    Expr * result          = stack.back();
+    Activation activation  = activations.back();
+    activations.pop_back();
+    pop_frames( activation.frames );
+    stack.resize( activation.base );
+
+    if( activations.size() == bottom )
+    {
+      return result;
+    }
+
+    stack.push_back( result );
+    chunk   = activations.back().chunk;
+    ip      = activations.back().ip;
+    context = activations.back().context;
+    DISPATCH();
+  }
+
+#ifndef VM_COMPUTED_GOTO
+    default :
+      UNREACHABLE
+      return make_nil();
+  }
+#endif
+
+#undef ENTER
+#undef REPLACE
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+} // namespace vm
+
+} // namespace lisp
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "eval.h"
+#include "expr.h"
+#include "gc.h"
+#include "util.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace lisp
+{
+
+class Node;
+
+///////////////////////////////////////////////////////////////////////////////
+// bytecode virtual machine
+namespace vm
+{
+
+// operands follow the opcode in the code vector, k indexes the constants, c
+// the child chunks, g the global caches and t is a position in the code
+enum Op : std::uint32_t
+{
+  OP_CONST,         // k      push constants[k]
+  OP_LOOKUP,        // k      push the value of the symbol constants[k]
+  OP_LOCAL,         // d s k  push slot s of the frame d levels up, which holds the symbol constants[k]
+  OP_GLOBAL,        // k g    push the value of the global constants[k], its slot is cached in caches[g]
+  OP_DEFINE,        // k      define constants[k] as the top of the stack, replace it with void
+  OP_BIND,          // k      pop a value and define constants[k] as it
+  OP_POP,           //        drop the top of the stack
+  OP_JUMP,          // t      continue at t
+  OP_JUMP_IF_FALSE, // t      pop a value, continue at t if it is false
+  OP_OR,            // t      continue at t if the top of the stack is true, pop it otherwise
+  OP_AND,           // t      continue at t if the top of the stack is false, pop it otherwise
+  OP_LAMBDA,        // k c    push a lambda over constants[k], chunks[c] is its body
+  OP_MACRO,         // k      push a macro over constants[k]
+  OP_ENTER,         // c k    run chunks[c] in a new frame for the bindings constants[k]
+  OP_TAIL_ENTER,    // c k    run chunks[c] in a new frame instead of this chunk
+  OP_EXPAND,        // k e t  if the top of the stack is a macro, run its expansion of the form constants[k] and continue at t,
+                    //        the expansion is cached in expansions[e]
+  OP_TAIL_EXPAND,   // k e    the same, but the expansion replaces this chunk
+  OP_CALL,          // n      call the function below the top n values with them as arguments
+  OP_TAIL_CALL,     // n      the same, but the call replaces this chunk
+  OP_DOTIMES,       // t k    if the counter on top of the count is below it, bind constants[k] to the counter and
+                    //        count up, otherwise replace both with the value of the loop and continue at t
+  OP_DOLIST,        // t k    if the top of the stack is a cell, bind constants[k] to its car and replace it with its
+                    //        cdr, otherwise replace it with nil and continue at t
+  OP_CONS,          //        pop a cdr and a car and push a new cell of them
+  OP_SPLICE,        //        pop a rest and a list and push the list with the rest appended
+  OP_EVAL,          // k      evaluate constants[k] with the tree walker
+  OP_RETURN,        //        leave this chunk with the top of the stack as its result
+  OP_COUNT,
+};
+
+class Chunk;
+
+// the compiled expansion of a macro call, it is reused for as long as the
+// operator evaluates to the same macro
+struct Expansion
+{
+  Expr * macro = nullptr;
+  Chunk * code = nullptr;
+};
+
+// the compiled code of one form or lambda body
+class Chunk : public gc::Garbage
+{
+public:
+  void mark();
+  std::uint32_t add_constant( Expr * );
+  std::uint32_t add_chunk( Chunk * );
+
+  std::vector<std::uint32_t> code;
+  std::vector<Expr *> constants;
+  std::vector<Chunk *> chunks;
+  std::vector<GlobalCache> caches;
+  std::vector<Expansion> expansions;
+};
+
+Chunk * compile( Node * node );
+
+// the compiled body of a lambda or macro, it is compiled when it is first
+// needed
+Chunk * lambda_chunk( Expr * fn );
+
+Chunk * macro_chunk( Expr * fn );
+
+Expr * run( Chunk * chunk, Context & context, const IO & io );
+
+// the values and activations of the machine are roots
+void mark();
+
+// drops the values and activations of abandoned runs
+void reset();
+
+} // namespace vm
+
+} // namespace lisp
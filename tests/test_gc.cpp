@@ -0,0 +1,270 @@
+#include <gtest/gtest.h>
+
+#include "gc.h"
+#include "util.h"
+
+using namespace lisp;
+
+TEST_F( LispTest, test_gc_01 )
+{
+  std::string src = R"(
+(defun count-down (n)
+  (if (= n 0)
+    0
+    (count-down (- n 1))))
+
+(count-down 1000000)
+  )";
+
+  gc::stats.peak_size = gc::stats.heap_size;
+  std::size_t before  = gc::stats.collections + gc::stats.minor_collections;
+
+  int r = eval( src, ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "0" );
+
+  // millions of temporaries were allocated, but the heap never held more than
+  // a couple of collection cycles worth of them
+  EXPECT_GT( gc::stats.collections + gc::stats.minor_collections, before );
+  EXPECT_LT( gc::stats.peak_size, 4 * gc::stats.threshold );
+}
+
+TEST_F( LispTest, test_gc_02 )
+{
+  std::string src = R"(
+(defvar lst (list 1 2 3))
+
+(defun make-adder (a)
+  (lambda (b) (+ a b)))
+
+(defvar add5 (make-adder 5))
+  )";
+
+  int r = eval( src, ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+
+  gc::run();
+
+  r = eval( "(print lst (add5 3))", ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "(1 2 3)8" );
+}
+
+TEST_F( LispTest, test_gc_03 )
+{
+  std::string src = R"(
+(defun range (a b)
+  (if (= a b)
+    nil
+    (cons a (range (+ a 1) b))))
+
+(defun sum (lst)
+  (if (null? lst)
+    0
+    (+ (car lst) (sum (cdr lst)))))
+
+(defun loop (n acc)
+  (if (= n 0)
+    acc
+    (loop (- n 1) (+ acc (sum (map (lambda (x) (* x 2)) (range 0 10)))))))
+
+(loop 20000 0)
+  )";
+
+  gc::stats.peak_size = gc::stats.heap_size;
+
+  int r = eval( src, ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "1800000" );
+  EXPECT_LT( gc::stats.peak_size, 4 * gc::stats.threshold );
+}
+
+TEST_F( LispTest, test_gc_04 )
+{
+  std::string src = R"(
+(defun count-down (n)
+  (if (= n 0)
+    0
+    (count-down (- n 1))))
+
+(count-down 200000)
+  )";
+
+  std::size_t minor       = gc::stats.minor_collections;
+  std::size_t allocations = gc::stats.allocations;
+  std::size_t promoted    = gc::stats.promoted;
+
+  int r = eval( src, ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "0" );
+
+  // almost everything dies young and never leaves the nursery
+  EXPECT_GT( gc::stats.minor_collections, minor );
+  EXPECT_LT( gc::stats.promoted - promoted, ( gc::stats.allocations - allocations ) / 100 );
+}
+
+TEST_F( LispTest, test_gc_05 )
+{
+  int r = eval( "(defvar lst (list 1 2 3))", ctx, io );
+  EXPECT_EQ( r, 0 );
+
+  // 'lst' is promoted, appending then stores young cells into an old one
+  gc::run();
+  r = eval( "(append lst (list 4 5))", ctx, io );
+  EXPECT_EQ( r, 0 );
+
+  gc::minor();
+  r = eval( "(defvar tmp (map (lambda (x) (list x x)) (list 1 2 3 4 5 6 7 8)))", ctx, io );
+  EXPECT_EQ( r, 0 );
+
+  out.str( "" );
+  r = eval( "(print lst)", ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "(1 2 3 4 5)" );
+}
+
+TEST_F( LispTest, test_gc_06 )
+{
+  gc::set_mode( gc::INCREMENTAL );
+  gc::set_step_budget( 1 );
+
+  int r = eval( "(defvar lst (list 1 2))", ctx, io );
+  EXPECT_EQ( r, 0 );
+  gc::run();
+
+  // start a cycle and trace until the last cell of 'lst' has been visited
+  gc::set_threshold( 1 );
+  gc::minor();
+  Expr * tail = ctx.lookup( "lst" )->cdr();
+  while( gc::phase == gc::PHASE_MARKING && !tail->is_marked() )
+  {
+    gc::step();
+  }
+  gc::step();
+  ASSERT_EQ( gc::phase, gc::PHASE_MARKING );
+
+  // the new cells are only reachable through an object that was already traced
+  r = eval( "(append lst (list 3 4))", ctx, io );
+  EXPECT_EQ( r, 0 );
+
+  while( gc::phase != gc::PHASE_IDLE )
+  {
+    gc::step();
+  }
+  gc::set_threshold( 64 * 1024 );
+  gc::set_step_budget( gc::DEFAULT_STEP_BUDGET );
+
+  EXPECT_TRUE( tail->cdr()->is_old() );
+
+  r = eval( "(defvar tmp (map (lambda (x) (list x x)) (list 1 2 3 4 5 6 7 8)))", ctx, io );
+  EXPECT_EQ( r, 0 );
+
+  out.str( "" );
+  r = eval( "(print lst)", ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "(1 2 3 4)" );
+}
+
+TEST_F( LispTest, test_gc_07 )
+{
+  std::string src = R"(
+(defun range (a b)
+  (if (= a b)
+    nil
+    (cons a (range (+ a 1) b))))
+
+(defvar live (map (lambda (n) (range 0 50)) (range 0 500)))
+
+(defun count-down (n)
+  (if (= n 0)
+    0
+    (count-down (- n 1))))
+
+(count-down 300000)
+  )";
+
+  gc::set_mode( gc::INCREMENTAL );
+  gc::set_step_budget( 4096 );
+  gc::set_threshold( 1024 );
+  gc::stats.max_pause_ns   = 0;
+  gc::stats.total_pause_ns = 0;
+
+  std::size_t steps       = gc::stats.steps;
+  std::size_t collections = gc::stats.collections;
+
+  int r = eval( src, ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+
+  gc::set_threshold( 64 * 1024 );
+  gc::set_step_budget( gc::DEFAULT_STEP_BUDGET );
+
+  // full collections were split into steps and every pause was recorded
+  EXPECT_GT( gc::stats.steps, steps );
+  EXPECT_GT( gc::stats.collections, collections );
+  EXPECT_GT( gc::stats.max_pause_ns, 0u );
+  EXPECT_LE( gc::stats.max_pause_ns, gc::stats.total_pause_ns );
+}
+
+TEST_F( LispTest, test_gc_08 )
+{
+  Expr * ints[]  = { make_integer( 3 ), make_integer( 4 ) };
+  Expr * reals[] = { make_real( 0.5 ), make_integer( 4 ) };
+
+  // nil, booleans and small integers are shared and never allocated
+  std::size_t allocations = gc::stats.allocations;
+
+  EXPECT_EQ( make_nil(), make_nil() );
+  EXPECT_EQ( make_boolean( true ), make_boolean( true ) );
+  EXPECT_EQ( make_integer( 42 ), make_integer( 42 ) );
+
+  Expr * sum = builtin::f_add( ints[0], ints[1], Args{ nullptr, 0 } );
+  Expr * lt  = make_boolean( builtin::f_lt( Number{ ints[0] }, Number{ ints[1] } ) );
+  EXPECT_EQ( sum->as_integer(), 7 );
+  EXPECT_TRUE( lt->is_truthy() );
+  EXPECT_EQ( gc::stats.allocations, allocations );
+
+  // the arguments are never modified
+  sum = builtin::f_add( reals[0], reals[1], Args{ nullptr, 0 } );
+  EXPECT_EQ( sum->as_real(), 4.5 );
+  EXPECT_EQ( make_integer( 4 )->as_integer(), 4 );
+  EXPECT_EQ( gc::stats.allocations, allocations + 1 );
+
+  // cells are only padded to the alignment of what they hold
+  EXPECT_EQ( gc::Page::of( sum )->cell_size, sizeof( Expr ) );
+}
+
+TEST_F( LispTest, test_gc_09 )
+{
+  std::string src = R"(
+(defun build (n a b)
+  (if (= n 0)
+    (cons a b)
+    (build (- n 1) (cons n a) (cons nil b))))
+
+(defvar both (build 100000 nil nil))
+(defvar kept (car both))
+(defvar both nil)
+  )";
+
+  int r = eval( src, ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+
+  // every other cons of 'both' died, the holes it left are reused before the
+  // heap grows
+  gc::run();
+  std::size_t pages = gc::stats.pages;
+
+  r = eval( "(defvar more (build 30000 nil nil))", ctx, io );
+  EXPECT_EQ( r, 0 );
+  gc::run();
+  EXPECT_LE( gc::stats.pages, pages + gc::NURSERY_PAGES / 2 );
+}
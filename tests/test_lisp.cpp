@@ -70,6 +70,50 @@ TEST_F( LispTest, test_add_01 )
   EXPECT_EQ( out.str(), "5" );
 }
 
+TEST_F( LispTest, test_add_02 )
+{
+  // integers have 64 bits, a result that does not fit becomes a bignum
+  eval( "(list (+ 2147483647 1) (* 1609459200000 1000) (- -9223372036854775807 1) (* 9223372036854775807 2))",
+        ctx, io );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "(2147483648 1609459200000000 -9223372036854775808 18446744073709551614)" );
+}
+
+TEST_F( LispTest, test_bignum_01 )
+{
+  std::string src = R"(
+(defun pow (b n acc) (if (= n 0) acc (pow b (- n 1) (* acc b))))
+(defvar x (pow 3 2000 1))
+(defvar y (pow 7 1500 1))
+(print (list 123456789012345678901234567890 (- -9223372036854775808 1)
+             (- 100000000000000000000 99999999999999999999) (int? 100000000000000000000)
+             (= (* (+ x 1) (- y 1)) (- (+ (* x y) y) (+ x 1))) (= (* x y) (* y x))))
+  )";
+
+  // bignums print the way they are written and become integers again once
+  // they fit, large operands are multiplied with karatsuba
+  eval( src, ctx, io );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "(123456789012345678901234567890 -9223372036854775809 1 true true true)" );
+}
+
+TEST_F( LispTest, test_bignum_02 )
+{
+  std::string src = R"(
+(defun pow (b n acc) (if (= n 0) acc (pow b (- n 1) (* acc b))))
+(defvar x (pow 3 200 1))
+(defvar y (pow 7 150 1))
+(print (list (< 18446744073709551616 18446744073709551617) (> 18446744073709551617 18446744073709551616)
+             (< 9007199254740993 9007199254740992) (<= 1 2) (<= 2 1) (>= 2 2) (< 1 2.5)
+             (/ -100000000000000000000 3) (/ (- -9223372036854775807 1) -1) (= (/ (+ (* x y) 5) y) x)))
+  )";
+
+  // integers and bignums are ordered and divided exactly
+  eval( src, ctx, io );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "(true true false true false true true -33333333333333333333 9223372036854775808 true)" );
+}
+
 TEST_F( LispTest, test_mult_01 )
 {
   eval( "(* 2 3)", ctx, io );
@@ -676,6 +720,23 @@ TEST_F( LispTest, test_unquote_splice_01 )
   EXPECT_EQ( out.str(), "(1 2 3 4)" );
 }
 
+TEST_F( LispTest, test_unquote_splice_02 )
+{
+  std::string src = R"(
+(defun mk (x xs) `(a ,x (b ,@xs) c))
+(defvar l1 (mk 1 (list 2 3)))
+(defvar l2 (mk 4 (list 5)))
+(append l1 (list 9))
+(print l1 l2 `(,@(list 1 2)) `x)
+   )";
+
+  // every evaluation of a template builds new cells
+  int r = eval( src, ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "(a 1 (b 2 3) c 9)(a 4 (b 5) c)(1 2)x" );
+}
+
 TEST_F( LispTest, test_rest_01 )
 {
   std::string src = R"(
@@ -1000,7 +1061,7 @@ TEST_F( LispTest, test_logic_03 )
   int r           = eval( src, ctx, io );
   EXPECT_EQ( r, 0 );
   EXPECT_EQ( err.str(), "" );
-  EXPECT_EQ( out.str(), "true" );
+  EXPECT_EQ( out.str(), "\"hello world\"" );
 }
 
 TEST_F( LispTest, test_apply_1 )
@@ -1028,4 +1089,409 @@ TEST_F( LispTest, test_strip_01 )
   EXPECT_EQ( r, 0 );
   EXPECT_EQ( err.str(), "" );
   EXPECT_EQ( out.str(), "remove leading and trailing whitespace" );
-}
\ No newline at end of file
+}
+
+TEST_F( LispTest, test_symbol_01 )
+{
+  // every name is interned once, keywords have fixed ids
+  EXPECT_EQ( make_symbol( "foo" ), make_symbol( "foo" ) );
+  EXPECT_NE( make_symbol( "foo" ), make_symbol( "bar" ) );
+  EXPECT_TRUE( make_symbol( "if" )->is_symbol( SYM_IF ) );
+  EXPECT_FALSE( make_symbol( "foo" )->is_symbol( SYM_IF ) );
+
+  std::string src = "(print (= (quote foo) (quote foo)) (= (quote foo) (quote bar)))";
+  int r           = eval( src, ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "truefalse" );
+}
+
+TEST_F( LispTest, test_frames_01 )
+{
+  std::string src = R"(
+(defmacro capture (x)
+  `(lambda (y) (+ ,x y)))
+
+(defun adder (a)
+  (capture a))
+
+(defun shadow (a)
+  (progn
+    (defvar f (capture a))
+    (defvar a 10)
+    (f 1)))
+
+(defun nested (a)
+  (let ((b (* a 2)))
+    (lambda (c) (+ a b c))))
+
+(print ((adder 1) 2) (shadow 1) ((nested 1) 3))
+  )";
+
+  // the frames of 'adder' and 'shadow' are captured by a macro expansion and
+  // have to be moved to the heap when the closure is created
+  int r = eval( src, ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "3116" );
+}
+
+TEST_F( LispTest, test_frames_02 )
+{
+  std::string src = R"(
+(defun six (a b c d e f)
+  (let ((g (+ a b)) (h (+ c d)) (i (+ e f)))
+    (lambda (x) (list a f g h i x))))
+
+(defvar k (six 1 2 3 4 5 6))
+(defvar a 100)
+(print (k 7) a)
+  )";
+
+  // 'six' has more bindings than a frame keeps inline
+  int r = eval( src, ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "(1 6 3 7 11 7)100" );
+}
+
+TEST_F( LispTest, test_lexical_01 )
+{
+  std::string src = R"(
+(defun pick (a b)
+  (let ((a (+ a 1)) (c a))
+    (list a b c)))
+
+(defun later (x)
+  (let ((f (lambda (z) (+ y z))))
+    (progn
+      (defvar y x)
+      (f 1))))
+
+(defun twice (a a) a)
+
+(defvar y 0)
+(print (pick 1 2) (later 5) (twice 1 2) y)
+  )";
+
+  // slots are resolved ahead of time, variables defined at run time and
+  // repeated names have to see the same bindings as a lookup by name
+  int r = eval( src, ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "(2 2 2)620" );
+}
+
+TEST_F( LispTest, test_globals_01 )
+{
+  std::string src = R"(
+(defun get-y (n) (+ x n))
+(defvar x 1)
+(defvar a (get-y 0))
+(defvar x 2)
+
+(defun f (n)
+  (progn
+    (if (= n 2) (defvar x 5) nil)
+    (if (> n 0) (f (- n 1)) nil)
+    x))
+
+(print a (get-y 0) (f 2) (f 0))
+  )";
+
+  // 'x' is cached as a global, but the outermost call of 'f' binds it
+  int r = eval( src, ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "1252" );
+}
+
+TEST_F( LispTest, test_globals_02 )
+{
+  std::string src = R"(
+(defvar z 1)
+(defun make (bind) (progn (if bind (eval '(defvar z 7)) nil) (lambda () z)))
+(defvar p (make false))
+(print (p))
+(defvar q (make true))
+(print (q) (p))
+  )";
+
+  // 'z' was cached as a global when a frame captured by 'q' binds it
+  int r = eval( src, ctx, io );
+  EXPECT_EQ( r, 0 );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "171" );
+}
+
+// runs 'src' in a fresh context and returns everything it printed
+static std::string run_with_engine( Engine e, const std::string & src )
+{
+  std::ostringstream out, err;
+  IO io( out, err );
+  Context context;
+
+  Engine previous = engine();
+  set_engine( e );
+  ( void ) eval( src, context, io );
+  set_engine( previous );
+  return out.str() + err.str();
+}
+
+TEST_F( LispTest, test_engine_01 )
+{
+  std::vector<std::string> programs = {
+    "(defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))) (fib 15)",
+    "(defun make-adder (a) (lambda (b) (+ a b))) ((make-adder 3) 4)",
+    "(let ((a 1) (b (+ a 1))) (list a b))",
+    "(defun sign (n) (cond ((< n 0) -1) ((= n 0) 0) (true 1))) (list (sign -5) (sign 0) (sign 5))",
+    "(cond ((= 1 2) 3))",
+    "(list (or false 1) (or false false) (and 1 2) (and 1 false))",
+    "(defmacro unless (c x) `(if ,c nil ,x)) (defun f (x) (unless (= x 0) (/ 10 x))) (list (f 0) (f 5))",
+    "(defvar x 5) (defun g () x) (progn (defvar x 6) (print x) (g))",
+    "(map (lambda (x) (* x x)) (filter (lambda (x) (> x 2)) (list 1 2 3 4)))",
+    "(undefined-function 1 2)",
+    "(quote (a b c))",
+  };
+
+  // the tree walker is the reference for the other engines
+  for( const std::string & src : programs )
+  {
+    std::string expected = run_with_engine( ENGINE_TREE, src );
+    EXPECT_EQ( run_with_engine( ENGINE_CLOSURE, src ), expected ) << src;
+    EXPECT_EQ( run_with_engine( ENGINE_VM, src ), expected ) << src;
+  }
+}
+
+TEST_F( LispTest, test_macro_06 )
+{
+  std::string src = R"(
+(defmacro twice (x)
+  (progn
+    (print "expand ")
+    `(+ ,x ,x)))
+
+(defun f (n) (twice n))
+(print (f 1) (f 2) (macroexpand '(twice 3)))
+
+(defmacro one () 1)
+(defun g (x) (one))
+(defvar a (g 0))
+(defmacro one () 2)
+(print " " a (g 0))
+  )";
+
+  // the analyzing engines expand a call site once, until its macro changes
+  EXPECT_EQ( run_with_engine( ENGINE_CLOSURE, src ), "expand expand 24(+ 3 3) 12" );
+  EXPECT_EQ( run_with_engine( ENGINE_VM, src ), "expand expand 24(+ 3 3) 12" );
+  EXPECT_EQ( run_with_engine( ENGINE_TREE, src ), "expand expand expand 24(+ 3 3) 12" );
+}
+
+TEST_F( LispTest, test_native_01 )
+{
+  std::string src = R"(
+(print (+ 1 2 3 4 5 6 7 8 9 10 11 12) (list) (list 1 2 3))
+(car '(1) '(2))
+  )";
+
+  // natives receive their arguments as a span and the arity is checked before the call
+  eval( src, ctx, io );
+  EXPECT_EQ( out.str(), "78nil(1 2 3)" );
+  EXPECT_EQ( err.str(), "(error \"car expected 1 args but received 2\")\n" );
+}
+
+TEST_F( LispTest, test_native_02 )
+{
+  std::string src = R"(
+(print (strlen "hello") (substr 1 3 "hello") (strcmp "a" "a" "a") (< 1 2.5))
+(print (strlen 3))
+(strcmp "a" "a" 1)
+  )";
+
+  // typed natives check and convert their arguments before they are called
+  eval( src, ctx, io );
+  EXPECT_EQ( out.str(), "5eltruetrue(error: strlen expected a string as argument 1 but received 3)" );
+  EXPECT_EQ( err.str(), "(error \"strcmp expected a string as argument 3 but received 1\")\n" );
+}
+
+TEST_F( LispTest, test_optimize_01 )
+{
+  std::string src = R"(
+(+ 1 2 (* 3 4))
+(if (< 1 2) (strcat "a" "b" x) (error "no"))
+(let ((+ -)) (+ 1 2))
+(and x true (> 2 1) y)
+(cond ((= 1 2) 1) (x 2) (true 3) (y 4))
+(/ 1 0)
+  )";
+
+  // pure natives with constant arguments are folded, errors are left in place
+  eval( src, ctx, io, FLAG_DUMP_OPTIMIZED );
+  EXPECT_EQ( out.str(),
+             "15\n"
+             "(strcat \"a\" \"b\" x)\n"
+             "(let ((+ -)) (+ 1 2))\n"
+             "(and x y)\n"
+             "(cond (x 2) (true 3))\n"
+             "(/ 1 0)\n" );
+  EXPECT_EQ( err.str(), "" );
+
+  // a parameter that shadows a native is not folded
+  std::string shadow = R"(
+(defun g (+) (+ 1 2))
+(print (g -) (if (= 1 1) "y" "n") (and (< 1 2) (symbol? 'a)))
+  )";
+  out.str( "" );
+  eval( shadow, ctx, io );
+  EXPECT_EQ( out.str(), "-1ytrue" );
+  EXPECT_EQ( err.str(), "" );
+}
+
+TEST_F( LispTest, test_optimize_02 )
+{
+  std::string src = R"(
+(defmacro add12 () '(+ 1 2))
+(defun g (+) (add12))
+(print (g -) (g *))
+(defun h () (+ 1 2))
+(defvar + -)
+(print (h))
+  )";
+
+  // expansions and lambda bodies see the bindings of the call that runs them
+  eval( src, ctx, io );
+  EXPECT_EQ( out.str(), "-12-1" );
+  EXPECT_EQ( err.str(), "" );
+}
+
+TEST_F( LispTest, test_tail_01 )
+{
+  std::string src = R"(
+(defun count-or (n) (or (= n 0) (count-or (- n 1))))
+(defun count-and (n) (and (> n 0) (count-and (- n 1))))
+(defun count-cond (n acc)
+  (cond ((= n 0) acc)
+        (true (let ((m (- n 1))) (count-cond m (+ acc 1))))))
+(defun count-thunk (n)
+  (if (= n 0) "done" ((lambda () (count-thunk (- n 1))))))
+(defvar five (lambda () 5))
+(print (count-or 100000) (count-and 100000) (count-cond 100000 0) (count-thunk 100000) (five)
+       (or nil 2) (and 1 nil) (cond (true (print "a") "b")))
+  )";
+
+  // the last operand of and and or, the last form of a cond clause and calls
+  // without arguments are tail calls
+  eval( src, ctx, io );
+  EXPECT_EQ( out.str(), "atruefalse100000done52nilb" );
+  EXPECT_EQ( err.str(), "" );
+}
+
+TEST_F( LispTest, test_stack_01 )
+{
+  std::string deep = R"(
+(defun build (n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))
+(defun len (l) (if (null? l) 0 (+ 1 (len (cdr l)))))
+(print (len (build 200000 nil)))
+  )";
+
+  std::string overflow = R"(
+(defun down (n) (+ 1 (down n)))
+(defun down-map (n) (map (lambda (x) (down-map x)) (list n)))
+(print (list (error? (down 1)) (down-map 1)))
+  )";
+
+  // recursion is limited by the stack budget, running out of it abandons the
+  // program and leaves the interpreter usable
+  eval( deep, ctx, io );
+  EXPECT_EQ( out.str(), "200000" );
+  EXPECT_EQ( err.str(), "" );
+
+  std::size_t budget = stack_budget();
+  set_stack_budget( 1 << 20 );
+  out.str( "" );
+  eval( overflow, ctx, io );
+  EXPECT_EQ( out.str(), "" );
+  EXPECT_EQ( err.str(), "(error \"stack-overflow\")\n" );
+
+  err.str( "" );
+  eval( "(print (+ 1 2))", ctx, io );
+  set_stack_budget( budget );
+  EXPECT_EQ( out.str(), "3" );
+  EXPECT_EQ( err.str(), "" );
+}
+
+TEST_F( LispTest, test_loop_02 )
+{
+  std::string src = R"(
+(defvar n 0)
+(while (< n 3) (print n) (defvar n (+ n 1)))
+(dotimes (i 3) (print i))
+(dolist (x (list "a" "b")) (print x))
+(defun count-down (k) (progn (while (> k 0) (defvar k (- k 1))) k))
+(print (count-down 5) (dotimes (i 0) i) (dolist (x nil) x) (dotimes (i "a") i))
+  )";
+
+  eval( src, ctx, io );
+  EXPECT_EQ( out.str(), "012012ab0nilnil(error: dotimes expects an integer count)" );
+  EXPECT_EQ( err.str(), "" );
+}
+
+TEST_F( LispTest, test_budget_01 )
+{
+  std::string spin    = "(print 1) (while true nil)";
+  std::string recurse = "(defun f (n) (f (+ n 1))) (f 0)";
+  std::string grow    = "(defun grow (l) (grow (cons l l))) (grow nil)";
+
+  // a program that runs out of its budget is abandoned, the output it made
+  // so far stays and the interpreter remains usable
+  io.budget.steps = 100000;
+  eval( spin, ctx, io );
+  EXPECT_EQ( out.str(), "1" );
+  EXPECT_EQ( err.str(), "(error \"out-of-steps\")\n" );
+
+  err.str( "" );
+  eval( recurse, ctx, io );
+  EXPECT_EQ( err.str(), "(error \"out-of-steps\")\n" );
+
+  io.budget = Budget();
+  io.budget.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds( 50 );
+  err.str( "" );
+  eval( spin, ctx, io );
+  EXPECT_EQ( err.str(), "(error \"out-of-time\")\n" );
+
+  io.budget      = Budget();
+  io.budget.heap = 16 << 20;
+  err.str( "" );
+  eval( grow, ctx, io );
+  EXPECT_EQ( err.str(), "(error \"out-of-memory\")\n" );
+
+  io.budget = Budget();
+  out.str( "" );
+  err.str( "" );
+  eval( "(print (+ 1 2))", ctx, io );
+  EXPECT_EQ( out.str(), "3" );
+  EXPECT_EQ( err.str(), "" );
+}
+
+TEST_F( LispTest, test_budget_02 )
+{
+  std::string src = R"(
+(defun build (n a b)
+  (if (= n 0)
+    (cons a b)
+    (build (- n 1) (cons n a) (cons (cons nil nil) b))))
+(defvar kept (car (build 20000 nil nil)))
+(defvar kept (car (build 20000 kept nil)))
+(defvar kept (car (build 20000 kept nil)))
+  )";
+
+  // two thirds of what was promoted died and left holes in full pages. the
+  // holes hold the next list once the heap reaches its limit, the few pages
+  // to spare cover what the stack scan keeps alive. without the holes the
+  // list needs more than twice as many new pages.
+  eval( src, ctx, io );
+  io.budget.heap = ( gc::stats.pages + 6 ) * gc::PAGE_SIZE;
+  eval( "(defvar more (build 20000 nil nil)) (print (length kept) (length (car more)))", ctx, io );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "6000020000" );
+}
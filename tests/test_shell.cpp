@@ -56,4 +56,16 @@ TEST_F( ShellTest, test_shell_03 )
   EXPECT_EQ( out.str(), "GNU/Linux" );
 }
 
+TEST_F( ShellTest, test_shell_04 )
+{
+  // binary output is captured completely, including NUL bytes
+  std::string src = R"(
+(defvar data ($ (sh printf "a\0b\0c")))
+(print (strlen data) (substr 2 3 data))
+   )";
+  int r           = eval( src, ctx, io );
+  EXPECT_EQ( err.str(), "" );
+  EXPECT_EQ( out.str(), "5b" );
+}
+
 #endif
@@ -2,6 +2,9 @@
 
 #include <gtest/gtest.h>
 
+#include <cstdlib>
+#include <string>
+
 #include "lisp.h"
 #include "parser.h"
 #include "tokenizer.h"
@@ -14,6 +17,21 @@ public:
   LispTest()
       : io( out, err )
   {
+    // the suite runs once for every engine, see tests/CMakeLists.txt
+    const char * name  = std::getenv( "LISP_ENGINE" );
+    std::string engine = ( name != nullptr ) ? name : "";
+    if( engine == "tree" )
+    {
+      set_engine( ENGINE_TREE );
+    }
+    else if( engine == "vm" )
+    {
+      set_engine( ENGINE_VM );
+    }
+    else
+    {
+      set_engine( ENGINE_CLOSURE );
+    }
   }
 
 protected: